@@ -12,6 +12,7 @@ using namespace std;
 
 #define COMFLAG_INTERACTIVE	0x1
 
+#define COMERR_TIMEOUT	122
 #define COMERR_NOEFFECT	123
 #define COMERR_NOTINTERACTIVE	124
 #define COMERR_SYNTAX	125
@@ -38,12 +39,15 @@ public:
 	//int session_id;
 	int result_code;
 	vector<string> args;
-    vector<string> raw;
+    const char *line;
+    vector<string::size_type> offsets;
 
 	//CommandContext(int _session_id) : quit(false), session_id(_session_id), result_code(0) { }
     //CommandContext(const Session& _session) : session(_session), quit(false), result_code(0) { }
-    CommandContext(ScriptContext *cnx) : context(cnx), session(cnx->session()), quit(false), result_code(0) { }
+    CommandContext(ScriptContext *cnx) : context(cnx), session(cnx->session()), quit(false), result_code(0), line("") { }
 	void add_arg(const string &arg) { args.push_back(arg); }
+	// The unparsed remainder of the command line from argument i onwards.
+	const char *raw(unsigned i) const { return line + offsets[i]; }
 };
 
 class Command
@@ -80,6 +84,8 @@ public:
 void command_init(void);
 void command_add(Command *com);
 const Command *command_lookup(const string &name);
+const Command *command_lookup(const string &name, bool &ambiguous);
+void command_complete(const string &prefix, vector<string> &names);
 const vector<CommandReference> &command_list(void);
 
 #endif
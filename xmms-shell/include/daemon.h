@@ -0,0 +1,15 @@
+#ifndef _XMMS_SHELL_DAEMON_H_
+
+#define _XMMS_SHELL_DAEMON_H_
+
+#include "session.h"
+
+#include <string>
+
+using namespace std;
+
+string daemon_socket_path(int session_id);
+int daemon_run(const Session& session);
+bool daemon_forward(int session_id, const string& expr, int& result);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _XMMS_SHELL_DIRSCAN_H_
+
+#define _XMMS_SHELL_DIRSCAN_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define DIRSCAN_MAX_THREADS 32
+#define DIRSCAN_EXTENSIONS "mp3,mp2,mpc,ogg,oga,opus,flac,wav,aif,aiff,m4a,aac,wma,ape,wv,mod,s3m,xm,it"
+
+int directory_scan(const vector<string>& roots, const string& extensions, vector<string>& files);
+
+#endif
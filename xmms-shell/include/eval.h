@@ -3,9 +3,68 @@
 #define _XMMS_SHELL_EVAL_H_
 
 #include "script.h"
+#include "command.h"
 
-int eval_command(ScriptContext *context, string& expr, int& quit, bool interactive);
-int eval_command_string(ScriptContext *context, string& expr, int& quit, bool interactive);
+/*
+ * Splits a stream of input into commands at unquoted semicolons and
+ * newlines.  Input may be fed in arbitrary chunks; each command is
+ * dispatched as soon as its terminator is seen, and quoting state carries
+ * over from one chunk to the next.
+ */
+class CommandParser
+{
+    ScriptContext *context;
+    bool interactive;
+    string buffer;
+    string::size_type scan;
+    char quote;
+    bool escape;
+    int result;
+    bool dispatched;
 
-#endif
+    int dispatch(const string& expr, int& quit);
+
+protected:
+    virtual int command(const string& expr, int& quit);
+
+public:
+    CommandParser(ScriptContext *context, bool interactive);
+    virtual ~CommandParser();
+
+    int feed(const string& chunk, int& quit);
+    int finish(int& quit);
+    bool pending(void) const;
+    int result_code(void) const { return result; }
+    bool any_dispatched(void) const { return dispatched; }
+};
+
+/*
+ * A script split into commands, tokenized and resolved ahead of time so
+ * that running it again does no parsing or command lookup.
+ */
+class CompiledScript
+{
+public:
+    class Instruction
+    {
+    public:
+        const Command *command;
+        string line;
+        vector<string> args;
+        vector<string::size_type> offsets;
+    };
 
+    vector<Instruction> instructions;
+
+    void compile(const string& text);
+    int run(ScriptContext *context, int& quit, bool interactive) const;
+};
+
+const CompiledScript *script_compile(const string& path);
+
+int eval_command(ScriptContext *context, const string& expr, int& quit, bool interactive);
+int eval_command_string(ScriptContext *context, const string& expr, int& quit, bool interactive);
+int eval_script(ScriptContext *context, int& quit, bool interactive);
+int eval_file(ScriptContext *context, const string& path, int& quit, bool interactive);
+
+#endif
@@ -3,19 +3,91 @@
 #define _XMMS_SHELL_FORMATTER_H_
 
 #include <string>
+#include <vector>
 
 using namespace std;
 
-class Formatter
+/*
+ * Maps each %-specifier character straight to a member function of T that
+ * produces its value.  Specifiers without a callback expand to nothing.
+ */
+template<class T> class FormatTable
 {
-	string values[256];
 public:
-    Formatter();
-    ~Formatter();
-    void associate(char id, const string value);
-    void dissociate(char id);
-    string expand(const string format) const;
+    typedef string (T::*Callback)(char id);
+
+private:
+    Callback callbacks[256];
+
+public:
+    FormatTable()
+    {
+        for(int i = 0; i < 256; i++) {
+            callbacks[i] = 0;
+        }
+    }
+
+    void bind(char id, Callback callback) { callbacks[(unsigned char) id] = callback; }
+
+    string resolve(T& object, char id) const
+    {
+        Callback callback = callbacks[(unsigned char) id];
+
+        return callback ? (object.*callback)(id) : string();
+    }
 };
 
-#endif
+/*
+ * A format string parsed once into literal and specifier segments.  "%%"
+ * is a literal percent sign, as is a lone `%' at the end.  Expanding
+ * resolves each distinct specifier once, however often it occurs, and
+ * builds the result in a buffer reserved to its exact size.
+ */
+class FormatTemplate
+{
+    class Segment
+    {
+    public:
+        int slot;
+        string::size_type offset, length;
+
+        Segment(int _slot, string::size_type _offset, string::size_type _length)
+            : slot(_slot), offset(_offset), length(_length) { }
+    };
 
+    string format;
+    vector<Segment> segments;
+    vector<char> specifiers;
+
+public:
+    FormatTemplate(const string& format = "");
+
+    void compile(const string& format);
+    const string& source(void) const { return format; }
+    bool uses(char id) const;
+
+    template<class T> string expand(const FormatTable<T>& table, T& object) const
+    {
+        vector<string> values(specifiers.size());
+        string::size_type size = 0;
+        string result;
+
+        for(unsigned i = 0; i < specifiers.size(); i++) {
+            values[i] = table.resolve(object, specifiers[i]);
+        }
+        for(vector<Segment>::const_iterator i = segments.begin(); i != segments.end(); i++) {
+            size += i->slot < 0 ? i->length : values[i->slot].size();
+        }
+        result.reserve(size);
+        for(vector<Segment>::const_iterator i = segments.begin(); i != segments.end(); i++) {
+            if(i->slot < 0) {
+                result.append(format, i->offset, i->length);
+            } else {
+                result.append(values[i->slot]);
+            }
+        }
+        return result;
+    }
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <glib.h>
 
 gchar *getline(gchar *prompt);
+void getline_set_idle(int (*pending)(void), int (*run)(void));
 void getline_init(void);
 
 #endif
@@ -0,0 +1,52 @@
+#ifndef _XMMS_SHELL_PIPELINE_H_
+
+#define _XMMS_SHELL_PIPELINE_H_
+
+#include "session.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define PIPELINE_DEPTH 16
+#define PIPELINE_CHUNK 64
+
+class PipelineJob
+{
+public:
+    virtual ~PipelineJob() { }
+
+    virtual void run(gint32 sid, int index) = 0;
+};
+
+/*
+ * XMMS answers exactly one request per control socket connection, but it
+ * services every request that is queued when its main loop comes around.
+ * A Pipeline keeps up to `depth' requests in flight at once, so a range of
+ * N requests costs roughly N / depth round trips instead of N.  Results
+ * are stored by index, so they come back in order regardless of which
+ * request finished first.
+ */
+class Pipeline
+{
+    Session session;
+    int depth;
+    int chunk;
+    pthread_mutex_t lock;
+    PipelineJob *job;
+    int next, end;
+
+    static void *worker(void *arg);
+    bool claim(int& from, int& to);
+
+public:
+    Pipeline(const Session& session, int depth = PIPELINE_DEPTH, int chunk = PIPELINE_CHUNK);
+    ~Pipeline();
+
+    void run(PipelineJob& job, int start, int end);
+    void fetch_strings(gchar *(*request)(gint, gint), int start, int end, vector<string>& results);
+};
+
+#endif
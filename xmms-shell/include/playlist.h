@@ -2,15 +2,93 @@
 
 #define _XMMS_SHELL_PLAYLIST_H_
 
+#include "playlistindex.h"
 #include "session.h"
 
+#include <utility>
 #include <vector>
 
 using namespace std;
 
+#define PLAYLIST_CACHE_PROBES 4
+#define PLAYLIST_CACHE_CHUNK 256
+#define PLAYLIST_CACHE_TTL 0.25
+
+class PlaylistCache
+{
+public:
+    typedef enum { FILENAMES, TITLES } Field;
+
+    class Statistics
+    {
+    public:
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long validations;
+
+        Statistics() : hits(0), misses(0), validations(0) { }
+    };
+
+private:
+    int len;
+    bool grown;
+    double checked;
+    int next_probe;
+    vector<string> entries[2];
+    vector<bool> present[2];
+    PlaylistCache::Statistics stats;
+    PlaylistIndex index;
+
+    void resize(int length);
+    int load(const Session& session, Field field, int start, int stop);
+    int scan(const Session& session, const vector<int>& chunks, bool shifted);
+
+public:
+    PlaylistCache();
+
+    const PlaylistCache::Statistics& statistics(void) const;
+    void validate(const Session& session);
+    void fetch(const Session& session, Field field, int start, int stop, vector<string>& list);
+    void search(const Session& session, const string& query, vector<int>& positions, vector<string> *titles = 0);
+    void fuzzy_search(const Session& session, const string& query, vector<pair<int, int> >& ranked);
+    void invalidate(void);
+    void appended(void);
+    void removed(int start, int stop);
+};
+
+#define PLAYLIST_LOAD_BATCH 512
+
+typedef void (*LoadProgress)(int loaded, int total, void *data);
+
+class PlaylistLoader
+{
+    Session session;
+    GList *batch;
+    int pending;
+    int loaded;
+    int total;
+    LoadProgress progress;
+    void *progress_data;
+
+    void discard(void);
+
+public:
+    PlaylistLoader(const Session& session, int total = -1);
+    ~PlaylistLoader();
+
+    void set_progress(LoadProgress progress, void *data = 0);
+    void add(const char *filename, int length);
+    void add(const string& filename);
+    void flush(void);
+    int count(void) const;
+};
+
 class Playlist
 {
     Session session;
+
+    void fetch_range(PlaylistCache::Field field, int start, int stop, vector<string>& list) const;
+
 public:
     Playlist(const Session& session);
     ~Playlist();
@@ -23,14 +101,17 @@ public:
     string title(int pos) const;
     string current_filename(void) const;
     string filename(int pos) const;
-    vector<string> filenames(void) const;
-    vector<string> titles(void) const;
+    vector<string> filenames(int start = 1, int stop = -1) const;
+    vector<string> titles(int start = 1, int stop = -1) const;
+    vector<int> search(const string& text, vector<string> *titles = 0) const;
+    int fuzzy_search(const string& text) const;
     int next(void) const;
     int prev(void) const;
     void clear(void) const;
-    int load(vector<string>::const_iterator start, vector<string>::const_iterator end);
+    int load(vector<string>::const_iterator start, vector<string>::const_iterator end, LoadProgress progress = 0, void *data = 0);
     void remove(int pos) const;
     int remove(int pos1, int pos2) const;
+    int remove(vector<pair<int, int> > ranges) const;
 };
 
 class PlaylistPositionOutOfBoundsException : public Exception
@@ -39,6 +120,7 @@ class PlaylistPositionOutOfBoundsException : public Exception
 
 public:
     PlaylistPositionOutOfBoundsException(const Playlist& playlist, int position, int min_value = 1);
+    PlaylistPositionOutOfBoundsException(int position, int length, int min_value = 1);
     virtual ~PlaylistPositionOutOfBoundsException();
 
     virtual string to_string(void) const;
@@ -0,0 +1,14 @@
+#ifndef _XMMS_SHELL_PLAYLISTFILE_H_
+
+#define _XMMS_SHELL_PLAYLISTFILE_H_
+
+#include "playlist.h"
+
+#include <string>
+
+using namespace std;
+
+bool playlist_file_is_playlist(const string& path);
+int playlist_file_load(PlaylistLoader& loader, const string& path);
+
+#endif
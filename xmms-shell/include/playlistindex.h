@@ -0,0 +1,43 @@
+#ifndef _XMMS_SHELL_PLAYLISTINDEX_H_
+
+#define _XMMS_SHELL_PLAYLISTINDEX_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#define PLAYLIST_INDEX_CHUNK 256
+
+class PlaylistIndex
+{
+    class Chunk
+    {
+    public:
+        vector<unsigned> trigrams;
+        vector<unsigned long long> masks;
+        vector<unsigned long long> signatures;
+        bool dirty;
+
+        Chunk() : dirty(true) { }
+    };
+
+    int len;
+    vector<Chunk> chunks;
+
+    static void add_trigrams(const string& str, unsigned long long entry, vector<unsigned long long>& keys);
+    static unsigned long long signature(const string& str);
+    static bool score(const string& title, const string& query, int& total);
+
+public:
+    PlaylistIndex();
+
+    void resize(int length);
+    void touch(int first, int last);
+    void update(const vector<string>& titles, const vector<string>& filenames);
+    void search(const vector<string>& titles, const vector<string>& filenames, const string& query, vector<int>& positions) const;
+    void fuzzy_search(const vector<string>& titles, const string& query, vector<pair<int, int> >& ranked) const;
+};
+
+#endif
@@ -19,6 +19,7 @@ public:
 protected:
     Env env;
     Session sess;
+    bool continuation;
 
 public:
 
@@ -26,6 +27,7 @@ public:
     virtual ~ScriptContext();
 
     const Session& session(void) const;
+    void set_continuation(bool cont);
     void set_session(const Session& session);
 
     const Env& const_environment(void) const;
@@ -36,6 +38,7 @@ public:
     bool unset_env(string key);
     bool has_env(string key) const;
 
+    virtual bool is_interactive(void) const;
     virtual string get_line(void) = 0;
 };
 
@@ -52,16 +55,37 @@ public:
 
 class InteractiveContext : public ScriptContext
 {
-    class PromptFormatter : public Formatter
+    class PromptFormatter
     {
+        Session& session;
+        FormatTemplate compiled;
+        unsigned fields;
+        bool query;
+        int running_state;
+        Session::Snapshot state;
+
+        static const FormatTable<PromptFormatter>& table(void);
+        static unsigned field(char id);
+
+        string name(char id);
+        string status(char id);
+        string value(char id);
+
     public:
         PromptFormatter(Session& session);
+
+        void prepare(bool query);
+        bool running(void);
+        string expand(const string& format);
     };
 
+    PromptFormatter formatter;
+
 public:
     InteractiveContext();
     virtual ~InteractiveContext();
 
+    virtual bool is_interactive(void) const;
     virtual string get_line(void);
 };
 
@@ -14,7 +14,11 @@
 
 using namespace std;
 
+#define SESSION_LEASE 0.5
+
 class Playlist;
+class PlaylistCache;
+class Watcher;
 class Window;
 
 class Session
@@ -22,9 +26,63 @@ class Session
 public:
     typedef enum { STOPPED, PLAYING, PAUSED } PlayMode;
 
+    class Statistics
+    {
+    public:
+        unsigned long commands;
+        unsigned long connects;
+        unsigned long reconnects;
+
+        Statistics() : commands(0), connects(0), reconnects(0) { }
+    };
+
+    /*
+     * The state of XMMS at one moment, as returned by snapshot().  Only
+     * the fields named in `fields' were requested and are meaningful.
+     */
+    class Snapshot
+    {
+    public:
+        enum {
+            PLAY_MODE = 0x1, INFO = 0x2, TIME = 0x4, VOLUME = 0x8,
+            BALANCE = 0x10, REPEAT = 0x20, SHUFFLE = 0x40, SKIN = 0x80,
+            EQ = 0x100, POSITION = 0x200, LENGTH = 0x400, TITLE = 0x800,
+            FILENAME = 0x1000, DURATION = 0x2000, ALL = 0x3fff
+        };
+
+        unsigned fields;
+        double taken;
+        gboolean running;
+        gboolean playing, paused;
+        gint32 rate, freq, nch;
+        gint32 time;
+        gint32 left, right;
+        gint32 balance;
+        gboolean repeat, shuffle;
+        string skin;
+        float preamp;
+        vector<float> bands;
+        gint32 position, length;
+        string title, filename;
+        gint32 duration;
+
+        Snapshot() : fields(0), taken(0), running(FALSE), playing(FALSE), paused(FALSE), rate(0), freq(0), nch(0), time(0),
+            left(0), right(0), balance(0), repeat(FALSE), shuffle(FALSE), preamp(0), position(0), length(0), duration(0) { }
+
+        Session::PlayMode mode(void) const { return playing ? (paused ? PAUSED : PLAYING) : STOPPED; }
+    };
+
+    enum { TRACK_CHANGE = 0x1, PLAY_STATE = 0x2, VOLUME_CHANGE = 0x4, PLAYLIST_CHANGE = 0x8 };
+
+    typedef void (*Listener)(const Session::Snapshot& before, const Session::Snapshot& after, unsigned events, void *data);
+
 private:
+    class Connection;
+    class Operation;
+    friend class FlushJob;
+
+    Connection *conn;
 #if HAVE_XMMS_SESSION_CONNECT
-    XMMSSession *xs;
     guint32 version;
     Session::PlayMode mode;
     gint32 rate;
@@ -42,17 +100,36 @@ private:
     void update_state(void);
 
 #endif
-    gint32 sid;
 
 public:
     Session(int id = 0);
     Session(const Session& session);
+    Session& operator=(const Session& session);
     ~Session();
 
     Playlist get_playlist(void) const;
     Window get_window(void) const;
     gint32 get_id(void) const;
+    gint32 remote_id(unsigned long requests = 1) const;
+    const Session::Statistics& statistics(void) const;
+    void count_command(void) const;
+    const Session::Snapshot snapshot(unsigned fields = Session::Snapshot::ALL) const;
+    static const Session::Snapshot poll(gint32 id, unsigned fields);
+    Watcher& watcher(void) const;
+    int subscribe(unsigned events, Session::Listener listener, void *data) const;
+    void unsubscribe(int subscription) const;
+    void dispatch(void) const;
+    gboolean events_pending(void) const;
+    PlaylistCache& playlist_cache(void) const;
     void ensure_running(void) const;
+    gboolean alive(void) const;
+    void expire(void) const;
+    void sync(void) const;
+    void begin(void) const;
+    bool commit(void) const;
+    bool batching(void) const;
+    void flush(void) const;
+    void reset(void) const;
     gboolean is_running(void) const;
     guint32 get_version(void);
     void stop(void);
@@ -94,6 +171,7 @@ public:
     void set_eq_bands(const vector<float>& bands);
     void set_eq_band(gint32 band, float value);
 #endif
+    void set_playlist_position(gint32 index) const;
     void quit(void);
 };
 
@@ -7,6 +7,7 @@
 using namespace std;
 
 string int_to_string(int n);
+double current_time(void);
 
 #endif
 
@@ -0,0 +1,79 @@
+#ifndef _XMMS_SHELL_WATCH_H_
+
+#define _XMMS_SHELL_WATCH_H_
+
+#include "session.h"
+
+#include <pthread.h>
+#include <vector>
+
+using namespace std;
+
+#define WATCH_MIN_INTERVAL 0.05
+#define WATCH_MAX_INTERVAL 1.0
+
+/*
+ * XMMS cannot push changes to its clients over the xmmsctrl protocol, so
+ * one background thread per session polls it on behalf of everybody who
+ * wants to know about them: event subscribers, state snapshots for the
+ * prompt and STATUS, and WAIT-FOR.  It polls only while somebody needs it,
+ * only the fields they need, and adapts its rate to the track: slowly when
+ * idle, more often as the predicted end of the current track approaches.
+ */
+class Watcher
+{
+    class Subscription
+    {
+    public:
+        int id;
+        unsigned events;
+        Session::Listener listener;
+        void *data;
+    };
+
+    gint32 sid;
+    pthread_t thread;
+    bool started, stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup, changed;
+    int pipe_fds[2];
+    unsigned demand;
+    int waiters;
+    bool enabled;
+    double max_interval;
+    unsigned long generation;
+    unsigned long epoch, current_epoch;
+    bool dirty;
+    Session::Snapshot current, delivered;
+    unsigned pending;
+    vector<Subscription> subscriptions;
+    int next_id;
+
+    static void *worker(void *arg);
+    void run(void);
+    unsigned fields(void) const;
+    double interval(const Session::Snapshot& state) const;
+    void start(void);
+    void update_demand(void);
+
+public:
+    Watcher(gint32 sid);
+    ~Watcher();
+
+    static unsigned changes(const Session::Snapshot& before, const Session::Snapshot& after);
+
+    int subscribe(unsigned events, Session::Listener listener, void *data);
+    void unsubscribe(int id);
+    void set_polling(bool enabled, double max_interval = WATCH_MAX_INTERVAL);
+    bool polling(void) const;
+    double get_interval(void) const;
+    bool latest(Session::Snapshot& state, unsigned fields);
+    unsigned long wait(unsigned long generation, double deadline, Session::Snapshot& state);
+    void refresh(void);
+    void invalidate(void);
+    void dispatch(void);
+    unsigned pending_events(void);
+    int fd(void) const;
+};
+
+#endif
@@ -1,9 +1,32 @@
 #include "config.h"
 #include "command.h"
 #include <strings.h>
+#include <cctype>
 #include <algorithm>
 
+/*
+ * command_init compiles the sorted command table into a case-folded trie.
+ * Each node records the command named by the path to it, if any, and the
+ * single command reachable below it (or AMBIGUOUS when aliases of more
+ * than one command are).  Lookup is therefore linear in the length of
+ * the name, and ambiguous prefixes are detected rather than resolved to
+ * whichever command happens to sort first.
+ */
+
+class TrieNode
+{
+public:
+	vector<pair<char, int> > children;
+	int ref;
+	const Command *command;
+
+	TrieNode() : ref(-1), command(0) { }
+};
+
+#define AMBIGUOUS ((const Command *) -1)
+
 static vector<CommandReference> commands;
+static vector<TrieNode> trie;
 
 void command_add(Command *com)
 {
@@ -14,26 +37,108 @@ void command_add(Command *com)
 		commands.push_back(CommandReference(*p, com));
 }
 
+static int trie_child(int node, char c)
+{
+	vector<pair<char, int> >::const_iterator p;
+	const vector<pair<char, int> >& children = trie[node].children;
+
+	p = lower_bound(children.begin(), children.end(), pair<char, int>(c, -1));
+	if(p == children.end() || p->first != c)
+		return -1;
+	return p->second;
+}
+
 void command_init(void)
 {
 	sort(commands.begin(), commands.end());
+	trie.assign(1, TrieNode());
+	for(unsigned i = 0; i < commands.size(); i++) {
+		const string& name = commands[i].get_name();
+		const Command *com = commands[i].get_command();
+		int node = 0, next;
+
+		for(string::const_iterator p = name.begin(); ; p++) {
+			if(!trie[node].command)
+				trie[node].command = com;
+			else if(trie[node].command != com)
+				trie[node].command = AMBIGUOUS;
+			if(p == name.end())
+				break;
+
+			char c = tolower(*p);
+
+			if((next = trie_child(node, c)) < 0) {
+				next = trie.size();
+				trie.push_back(TrieNode());
+
+				vector<pair<char, int> >& children = trie[node].children;
+
+				children.insert(lower_bound(children.begin(), children.end(), pair<char, int>(c, -1)), pair<char, int>(c, next));
+			}
+			node = next;
+		}
+		trie[node].ref = i;
+	}
+}
+
+static int trie_find(const string &prefix)
+{
+	int node = 0;
+
+	for(string::const_iterator p = prefix.begin(); node >= 0 && p != prefix.end(); p++)
+		node = trie_child(node, tolower(*p));
+	return node;
+}
+
+/*
+ * Returns the command with the given name, or else the only command having
+ * a name that starts with it.  If several commands do, returns 0 and sets
+ * ambiguous.
+ */
+const Command *command_lookup(const string &name, bool &ambiguous)
+{
+	int node = trie_find(name);
+
+	ambiguous = false;
+	if(node < 0 || !name.size())
+		return 0;
+	if(trie[node].ref >= 0)
+		return commands[trie[node].ref].get_command();
+	if(trie[node].command == AMBIGUOUS) {
+		ambiguous = true;
+		return 0;
+	}
+	return trie[node].command;
 }
 
 const Command *command_lookup(const string &name)
 {
-	vector<CommandReference>::iterator p;
+	bool ambiguous;
 
-	for(p = commands.begin(); p != commands.end(); p++)
-		if(!strcasecmp((*p).get_name().c_str(), name.c_str()))
-			return (*p).get_command();
-	for(p = commands.begin(); p != commands.end(); p++)
-		if(!strncasecmp((*p).get_name().c_str(), name.c_str(), name.length()))
-			return (*p).get_command();
-	return 0;
+	return command_lookup(name, ambiguous);
+}
+
+static void trie_collect(int node, vector<string> &names)
+{
+	if(trie[node].ref >= 0)
+		names.push_back(commands[trie[node].ref].get_name());
+	for(vector<pair<char, int> >::const_iterator p = trie[node].children.begin(); p != trie[node].children.end(); p++)
+		trie_collect(p->second, names);
+}
+
+/*
+ * Appends, in sorted order, every command name and alias starting with
+ * prefix.
+ */
+void command_complete(const string &prefix, vector<string> &names)
+{
+	int node = trie_find(prefix);
+
+	if(node >= 0)
+		trie_collect(node, names);
 }
 
 const vector<CommandReference> &command_list(void)
 {
 	return commands;
 }
-
@@ -0,0 +1,344 @@
+#include "config.h"
+#include "daemon.h"
+#include "command.h"
+#include "eval.h"
+#include "script.h"
+#include "util.h"
+#include "watch.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <glib.h>
+
+/*
+ * A client connects to the daemon's socket and sends a Request header
+ * together with its own stdout and stderr descriptors, followed by its
+ * working directory and the expression.  The daemon evaluates the
+ * expression with those descriptors installed as its stdout and stderr,
+ * so output goes straight to wherever the client's would have, and then
+ * answers with the result code.  Requests are served one at a time, so a
+ * client has DAEMON_RECEIVE_TIMEOUT seconds to send its request before it
+ * is dropped.
+ * Either side talks only to a peer running as the same user.
+ */
+class Request
+{
+public:
+    guint32 cwd_length;
+    guint32 expr_length;
+};
+
+#define DAEMON_MAX_CWD 4096
+#define DAEMON_MAX_EXPR (1 << 20)
+#define DAEMON_RECEIVE_TIMEOUT 5
+
+string daemon_socket_path(int session_id)
+{
+    return string(g_get_tmp_dir()) + "/xmms-shell_" + g_get_user_name() + "." + int_to_string(session_id);
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+    char *p = (char *) buf;
+    ssize_t n;
+
+    while(len) {
+        if((n = read(fd, p, len)) <= 0) {
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *) buf;
+    ssize_t n;
+
+    while(len) {
+        if((n = write(fd, p, len)) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool socket_address(int session_id, struct sockaddr_un& addr)
+{
+    string path = daemon_socket_path(session_id);
+
+    if(path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+/*
+ * The socket lives in a shared directory, so anybody could have bound its
+ * path first.
+ */
+static bool peer_is_user(int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static int connect_daemon(int session_id)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if(!socket_address(session_id, addr) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    if(!peer_is_user(fd)) {
+        fprintf(stderr, "%s is not owned by you; not using it\n", addr.sun_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Sends expr to a running daemon for the given session and waits for its
+ * result.  Returns false, having sent nothing, if no daemon is listening.
+ */
+bool daemon_forward(int session_id, const string& expr, int& result)
+{
+    char cwd[4096];
+    Request request;
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr *cmsg;
+    int fds[2] = { 1, 2 }, fd;
+    gint32 code;
+
+    if((fd = connect_daemon(session_id)) < 0) {
+        return false;
+    }
+    if(!getcwd(cwd, sizeof(cwd))) {
+        strcpy(cwd, "/");
+    }
+    request.cwd_length = strlen(cwd);
+    request.expr_length = expr.size();
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(request);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    fflush(stdout);
+    fflush(stderr);
+    if(sendmsg(fd, &msg, 0) != (ssize_t) sizeof(request) || !write_all(fd, cwd, request.cwd_length) || !write_all(fd, expr.data(), expr.size())) {
+        close(fd);
+        return false;
+    }
+    if(!read_all(fd, &code, sizeof(code))) {
+        fprintf(stderr, "Lost connection to the xmms-shell daemon\n");
+        code = COMERR_UNKNOWN;
+    }
+    close(fd);
+    result = code;
+    return true;
+}
+
+static int evaluate(const Session& session, const string& expr)
+{
+    ScriptContext *context = new StringContext(expr);
+    int result, quit;
+
+    context->set_session(session);
+    try {
+        string line = context->get_line();
+
+        result = eval_command_string(context, line, quit, FALSE);
+    } catch(Exception& ex) {
+        fprintf(stderr, "%s\n", ex.to_string().c_str());
+        result = COMERR_UNKNOWN;
+    } catch(Exception *ex) {
+        fprintf(stderr, "%s\n", ex->to_string().c_str());
+        delete ex;
+        result = COMERR_UNKNOWN;
+    }
+    delete context;
+    // An unmatched BEGIN would otherwise hold back every later request.
+    session.reset();
+    return result;
+}
+
+static void serve(const Session& session, int client, int saved_out, int saved_err)
+{
+    Request request;
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr *cmsg;
+    vector<int> fds;
+    ssize_t n;
+    gint32 code;
+
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(request);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    n = recvmsg(client, &msg, 0);
+
+    /*
+     * Descriptors are installed in this process as soon as the message is
+     * received, so every one of them is closed below, whether it is used
+     * or not.
+     */
+    for(cmsg = n >= 0 ? CMSG_FIRSTHDR(&msg) : 0; cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int *p = (int *) CMSG_DATA(cmsg);
+
+            fds.insert(fds.end(), p, p + (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        }
+    }
+
+    bool valid = n == (ssize_t) sizeof(request) && fds.size() == 2 && !(msg.msg_flags & MSG_CTRUNC)
+        && request.cwd_length <= DAEMON_MAX_CWD && request.expr_length <= DAEMON_MAX_EXPR;
+    string cwd(valid ? request.cwd_length : 0, 0), expr(valid ? request.expr_length : 0, 0);
+
+    if(valid && read_all(client, &cwd[0], cwd.size()) && read_all(client, &expr[0], expr.size())) {
+        fflush(stdout);
+        fflush(stderr);
+        dup2(fds[0], 1);
+        dup2(fds[1], 2);
+        if(chdir(cwd.c_str()) < 0) {
+            fprintf(stderr, "Unable to change to `%s': %s\n", cwd.c_str(), strerror(errno));
+        }
+        code = evaluate(session, expr);
+        fflush(stdout);
+        fflush(stderr);
+        dup2(saved_out, 1);
+        dup2(saved_err, 2);
+        write_all(client, &code, sizeof(code));
+    }
+    for(vector<int>::const_iterator i = fds.begin(); i != fds.end(); i++) {
+        close(*i);
+    }
+}
+
+/*
+ * Listens for expressions forwarded by `xmms-shell -e' and evaluates them
+ * with this process's session, command table and playlist cache, which
+ * stay warm between requests.  Events for ON hooks are dispatched while
+ * waiting for the next request.  Runs until killed.
+ */
+int daemon_run(const Session& session)
+{
+    struct sockaddr_un addr;
+    int fd, client, saved_out, saved_err;
+
+    if(!socket_address(session.get_id(), addr)) {
+        fprintf(stderr, "Socket path too long: %s\n", daemon_socket_path(session.get_id()).c_str());
+        return 1;
+    }
+    if((client = connect_daemon(session.get_id())) >= 0) {
+        close(client);
+        fprintf(stderr, "An xmms-shell daemon is already listening on %s\n", addr.sun_path);
+        return 1;
+    }
+    unlink(addr.sun_path);
+
+    mode_t mask = umask(077);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        umask(mask);
+        fprintf(stderr, "Unable to listen on %s: %s\n", addr.sun_path, strerror(errno));
+        return 1;
+    }
+    umask(mask);
+    signal(SIGPIPE, SIG_IGN);
+    saved_out = dup(1);
+    saved_err = dup(2);
+    while(1) {
+        fd_set readable;
+        int events = session.watcher().fd();
+
+        FD_ZERO(&readable);
+        FD_SET(fd, &readable);
+        if(events >= 0) {
+            FD_SET(events, &readable);
+        }
+        if(select((fd > events ? fd : events) + 1, &readable, 0, 0, 0) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "select: %s\n", strerror(errno));
+            break;
+        }
+        if(events >= 0 && FD_ISSET(events, &readable)) {
+            session.dispatch();
+        }
+        if(!FD_ISSET(fd, &readable)) {
+            continue;
+        }
+        if((client = accept(fd, 0, 0)) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "accept: %s\n", strerror(errno));
+            break;
+        }
+        if(!peer_is_user(client)) {
+            close(client);
+            continue;
+        }
+
+        struct timeval timeout = { DAEMON_RECEIVE_TIMEOUT, 0 };
+
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve(session, client, saved_out, saved_err);
+        close(client);
+    }
+    close(fd);
+    unlink(addr.sun_path);
+    return 1;
+}
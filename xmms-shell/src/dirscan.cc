@@ -0,0 +1,220 @@
+#include "config.h"
+#include "dirscan.h"
+#include <algorithm>
+#include <deque>
+#include <dirent.h>
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Directories are walked by a pool of threads sharing one queue.  On
+ * network filesystems nearly all the time goes to waiting on readdir and
+ * stat, so the pool is sized well past the number of processors to keep
+ * many lookups outstanding.  Symbolic links to directories are not
+ * followed, which rules out cycles.  The result is sorted afterwards, so
+ * the order does not depend on thread scheduling.
+ */
+class DirectoryScan
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    deque<string> queue;
+    int busy;
+    vector<string> extensions;
+    vector<string> *files;
+
+    bool wanted(const char *name) const;
+    bool next(string& dir);
+    void done(void);
+    void scan(const string& dir, vector<string>& found);
+
+    static void *worker(void *arg);
+
+public:
+    DirectoryScan(const string& extensions, vector<string>& files);
+    ~DirectoryScan();
+
+    void run(const vector<string>& roots);
+};
+
+DirectoryScan::DirectoryScan(const string& list, vector<string>& _files) : busy(0), files(&_files)
+{
+    string::size_type p = 0, q;
+
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&wakeup, 0);
+    while(p <= list.size()) {
+        if((q = list.find(',', p)) == string::npos) {
+            q = list.size();
+        }
+        if(q > p) {
+            extensions.push_back("." + list.substr(p, q - p));
+        }
+        p = q + 1;
+    }
+}
+
+DirectoryScan::~DirectoryScan()
+{
+    pthread_cond_destroy(&wakeup);
+    pthread_mutex_destroy(&lock);
+}
+
+bool DirectoryScan::wanted(const char *name) const
+{
+    const char *dot = strrchr(name, '.');
+
+    if(!dot) {
+        return false;
+    }
+    for(vector<string>::const_iterator i = extensions.begin(); i != extensions.end(); i++) {
+        if(!strcasecmp(dot, i->c_str())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Waits for a directory to scan.  Returns false once the queue is empty
+ * and no other thread is still scanning (and so might add to it).
+ */
+bool DirectoryScan::next(string& dir)
+{
+    pthread_mutex_lock(&lock);
+    while(queue.empty() && busy) {
+        pthread_cond_wait(&wakeup, &lock);
+    }
+    if(queue.empty()) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    dir = queue.front();
+    queue.pop_front();
+    busy++;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+void DirectoryScan::done(void)
+{
+    pthread_mutex_lock(&lock);
+    if(--busy == 0 && queue.empty()) {
+        pthread_cond_broadcast(&wakeup);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void DirectoryScan::scan(const string& dir, vector<string>& found)
+{
+    DIR *d = opendir(dir.c_str());
+    struct dirent *e;
+    vector<string> subdirs;
+    struct stat st;
+
+    if(!d) {
+        return;
+    }
+    while((e = readdir(d))) {
+        if(e->d_name[0] == '.' && (!e->d_name[1] || (e->d_name[1] == '.' && !e->d_name[2]))) {
+            continue;
+        }
+
+        string path = dir[dir.size() - 1] == '/' ? dir + e->d_name : dir + "/" + e->d_name;
+        bool is_dir = false, is_file = false;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+        if(e->d_type == DT_DIR) {
+            is_dir = true;
+        } else if(e->d_type == DT_REG) {
+            is_file = true;
+        } else if(e->d_type == DT_LNK) {
+            is_file = wanted(e->d_name) && !stat(path.c_str(), &st) && S_ISREG(st.st_mode);
+        } else if(e->d_type == DT_UNKNOWN && !lstat(path.c_str(), &st)) {
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && !stat(path.c_str(), &st) && S_ISREG(st.st_mode));
+        }
+#else
+        if(!lstat(path.c_str(), &st)) {
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && !stat(path.c_str(), &st) && S_ISREG(st.st_mode));
+        }
+#endif
+        if(is_dir) {
+            subdirs.push_back(path);
+        } else if(is_file && wanted(e->d_name)) {
+            found.push_back(path);
+        }
+    }
+    closedir(d);
+    if(subdirs.size()) {
+        pthread_mutex_lock(&lock);
+        queue.insert(queue.end(), subdirs.begin(), subdirs.end());
+        pthread_cond_broadcast(&wakeup);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+void *DirectoryScan::worker(void *arg)
+{
+    DirectoryScan *ds = (DirectoryScan *) arg;
+    vector<string> found;
+    string dir;
+
+    while(ds->next(dir)) {
+        ds->scan(dir, found);
+        ds->done();
+    }
+    pthread_mutex_lock(&ds->lock);
+    ds->files->insert(ds->files->end(), found.begin(), found.end());
+    pthread_mutex_unlock(&ds->lock);
+    return 0;
+}
+
+void DirectoryScan::run(const vector<string>& roots)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = ncpu > 0 ? ncpu * 4 : 4;
+    vector<pthread_t> threads;
+    pthread_t thread;
+
+    if(n > DIRSCAN_MAX_THREADS) {
+        n = DIRSCAN_MAX_THREADS;
+    }
+    for(vector<string>::const_iterator i = roots.begin(); i != roots.end(); i++) {
+        string root = *i;
+
+        while(root.size() > 1 && root[root.size() - 1] == '/') {
+            root.erase(root.size() - 1);
+        }
+        queue.push_back(root);
+    }
+    for(int i = 1; i < n; i++) {
+        if(pthread_create(&thread, 0, worker, this)) {
+            break;
+        }
+        threads.push_back(thread);
+    }
+    worker(this);
+    for(vector<pthread_t>::iterator i = threads.begin(); i != threads.end(); i++) {
+        pthread_join(*i, 0);
+    }
+}
+
+/*
+ * Collects every file below the given directories whose extension is in
+ * the comma separated list, sorted by path.  Returns the number found.
+ */
+int directory_scan(const vector<string>& roots, const string& extensions, vector<string>& files)
+{
+    vector<string> found;
+    DirectoryScan ds(extensions, found);
+
+    ds.run(roots);
+    sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+    return found.size();
+}
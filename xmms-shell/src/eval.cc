@@ -2,110 +2,450 @@
 #include "eval.h"
 #include "command.h"
 #include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <map>
 #include <string.h>
 #include <cctype>
-#include <glib.h>
 
-static string dequote(const string &line, string::const_iterator &p, bool &completed)
+/*
+ * Splits line into arguments in a single pass.  Only the start offset of
+ * each argument is recorded in offsets; an argument is copied out of the
+ * line in one piece unless it contains quotes or escapes, in which case
+ * it is unquoted into a buffer reserved to the argument's length.
+ */
+static void tokenize(const string &line, bool &completed, vector<string>& args, vector<string::size_type>& offsets)
 {
-	string arg;
-	char qt = *p++;
+	const char *base = line.c_str(), *p = base, *end = base + line.size();
 
-	while(p != line.end() && *p != qt) {
-		if(qt == '"' && *p == '\\') {
-			if(++p == line.end()) {
-				completed = false;
-				break;
-			}
-		}
-		arg += *p++;
-	}
-	if(p == line.end())
-		completed = false;
-	else
-		p++;
-	return arg;
-}
+	completed = true;
+	while(p != end) {
+		while(p != end && (isspace(*p) || (*p == '\\' && p + 1 != end && p[1] == '\n')))
+			p += *p == '\\' ? 2 : 1;
+		if(p == end)
+			break;
 
-static void tokenize(const string &line, bool &completed, vector<string>& args, vector<string>& raw)
-{
-	string cur;
-	string::const_iterator p = line.begin();
-    int pos = 0;
+		const char *start = p;
+		bool plain = true;
 
-	completed = true;
-	while(p != line.end()) {
-		cur = "";
-		while(isspace(*p)) {
+		while(p != end && !isspace(*p)) {
+			if(*p == '\\' || *p == '"' || *p == '\'')
+				plain = false;
 			p++;
-            pos++;
-        }
-		if(p == line.end())
-			break;
-        raw.push_back(line.substr(pos));
-		while(p != line.end() && !isspace(*p)) {
+		}
+		offsets.push_back(start - base);
+		if(plain) {
+			args.push_back(string(start, p - start));
+			continue;
+		}
+		args.push_back(string());
+
+		string& cur = args.back();
+
+		cur.reserve(p - start);
+		for(p = start; p != end && !isspace(*p); ) {
 			if(*p == '\\') {
-				if(pos++, ++p == line.end()) {
+				if(++p == end) {
 					completed = false;
 					break;
 				}
+				if(*p == '\n') {
+					p++;
+					continue;
+				}
+				cur += *p++;
+			} else if(*p == '"' || *p == '\'') {
+				char qt = *p++;
+				const char *q = p;
+
+				while(p != end && *p != qt) {
+					if(qt == '"' && *p == '\\') {
+						cur.append(q, p - q);
+						q = ++p;
+						if(p == end)
+							break;
+					}
+					p++;
+				}
+				cur.append(q, p - q);
+				if(p == end)
+					completed = false;
+				else
+					p++;
+			} else
 				cur += *p++;
-                pos++;
-			} else if(*p == '"' || *p == '\'')
-				cur += dequote(line, p, completed);
-			else {
-				pos++;
-                cur += *p++;
-            }
 		}
-		args.push_back(cur);
 	}
 }
 
+static int execute_command(const Command *command, CommandContext& context, int& quit, bool interactive)
+{
+	if(!interactive && (command->get_flags() & COMFLAG_INTERACTIVE)) {
+		fprintf(stderr, "The `%s' command is available only in interactive mode\n", command->get_primary_name().c_str());
+		return COMERR_NOTINTERACTIVE;
+	}
+	context.session.count_command();
+	command->execute(context);
+	if(context.quit) {
+		quit = 1;
+	}
+	if(context.result_code == COMERR_SYNTAX) {
+		fprintf(stderr, "Usage: %s\n", command->get_syntax().c_str());
+	}
+	return context.result_code;
+}
+
 int eval_command(ScriptContext *scontext, const string& expr, int& quit, bool interactive)
 {
 	const Command *command;
 	CommandContext context(scontext);
-	bool completed;
+	bool completed, ambiguous;
 
     quit = 0;
-	tokenize(expr, completed, context.args, context.raw);
+	context.line = expr.c_str();
+	tokenize(expr, completed, context.args, context.offsets);
 	if(!completed) {
-		fprintf(stderr, "Incomplete command.  Multi-line entry of commands not yet implemented.\n");
+		fprintf(stderr, "Incomplete command: unterminated quote or escape\n");
 		return COMERR_SYNTAX;
 	}
 	if(context.args.size()) {
-		if(!(command = command_lookup(context.args[0]))) {
-			fprintf(stderr, "Invalid command: %s\n", context.args[0].c_str());
+		if(!(command = command_lookup(context.args[0], ambiguous))) {
+			if(ambiguous) {
+				vector<string> names;
+
+				command_complete(context.args[0], names);
+				fprintf(stderr, "Ambiguous command: %s (could be", context.args[0].c_str());
+				for(vector<string>::const_iterator p = names.begin(); p != names.end(); p++)
+					fprintf(stderr, "%s %s", p == names.begin() ? "" : ",", p->c_str());
+				fprintf(stderr, ")\n");
+			} else
+				fprintf(stderr, "Invalid command: %s\n", context.args[0].c_str());
 			return COMERR_BADCOMMAND;
 		}
-		if(!interactive && (command->get_flags() & COMFLAG_INTERACTIVE)) {
-			fprintf(stderr, "The `%s' command is available only in interactive mode\n", command->get_primary_name().c_str());
-			return COMERR_NOTINTERACTIVE;
-		}
-		command->execute(context);
-		if(context.quit) {
-			quit = 1;
-        }
-		if(context.result_code == COMERR_SYNTAX) {
-			fprintf(stderr, "Usage: %s\n", command->get_syntax().c_str());
-        }
+		context.session.dispatch();
+		return execute_command(command, context, quit, interactive);
 	}
 	return context.result_code;
 }
 
-int eval_command_string(ScriptContext *scontext, string& expr, int& quit, bool interactive)
+CommandParser::CommandParser(ScriptContext *cnx, bool _interactive)
+    : context(cnx), interactive(_interactive), scan(0), quote(0), escape(false), result(0), dispatched(false)
+{
+}
+
+CommandParser::~CommandParser()
+{
+}
+
+int CommandParser::command(const string& expr, int& quit)
+{
+	return eval_command(context, expr, quit, interactive);
+}
+
+int CommandParser::dispatch(const string& expr, int& quit)
+{
+	if(expr.find_first_not_of(" \t") != string::npos)
+		dispatched = true;
+	return result = command(expr, quit);
+}
+
+int CommandParser::feed(const string& chunk, int& quit)
+{
+	string::size_type start = 0;
+
+	quit = 0;
+	buffer += chunk;
+	for(; !quit && scan < buffer.size(); scan++) {
+		char c = buffer[scan];
+
+		if(escape)
+			escape = false;
+		else if(quote) {
+			if(c == quote)
+				quote = 0;
+			else if(c == '\\' && quote == '"')
+				escape = true;
+		} else if(c == '\\')
+			escape = true;
+		else if(c == '"' || c == '\'')
+			quote = c;
+		else if(c == ';' || c == '\n' || c == '\r') {
+			dispatch(buffer.substr(start, scan - start), quit);
+			start = scan + 1;
+		}
+	}
+	if(quit) {
+		buffer.erase();
+		scan = 0;
+		quote = 0;
+		escape = false;
+	} else {
+		buffer.erase(0, start);
+		scan -= start;
+	}
+	return result;
+}
+
+/*
+ * Dispatches whatever is left at the end of the input.  An unterminated
+ * quote or trailing backslash is reported as a syntax error by
+ * eval_command.
+ */
+int CommandParser::finish(int& quit)
+{
+	string expr;
+
+	quit = 0;
+	expr.swap(buffer);
+	scan = 0;
+	quote = 0;
+	escape = false;
+	if(expr.size())
+		dispatch(expr, quit);
+	return result;
+}
+
+/*
+ * True when part of a command has been read but not yet dispatched
+ * because it ends inside quotes or with a backslash.
+ */
+bool CommandParser::pending(void) const
+{
+	return quote || escape;
+}
+
+/*
+ * Input that nobody is watching runs as one batch, so consecutive control
+ * requests whose results are not read go to XMMS together.
+ */
+class AutoBatch
+{
+	const Session& session;
+	bool open;
+
+public:
+	AutoBatch(ScriptContext *scontext) : session(scontext->session()), open(!scontext->is_interactive())
+	{
+		if(open)
+			session.begin();
+	}
+
+	~AutoBatch()
+	{
+		if(open)
+			session.commit();
+	}
+};
+
+int eval_command_string(ScriptContext *scontext, const string& expr, int& quit, bool interactive)
+{
+	CommandParser parser(scontext, interactive);
+	AutoBatch batch(scontext);
+
+	parser.feed(expr, quit);
+	if(!quit)
+		parser.finish(quit);
+	return parser.result_code();
+}
+
+/*
+ * Reads and runs commands from the context until EOF or QUIT, executing
+ * each one as soon as it is complete.  Returns the result of the last
+ * command, or 127 if the input held none.
+ */
+int eval_script(ScriptContext *scontext, int& quit, bool interactive)
+{
+	CommandParser parser(scontext, interactive);
+	AutoBatch batch(scontext);
+
+	quit = 0;
+	try {
+		while(!quit) {
+			scontext->set_continuation(parser.pending());
+
+			string line = scontext->get_line();
+
+			if(!line.size() || line[line.size() - 1] != '\n')
+				line += '\n';
+			parser.feed(line, quit);
+		}
+	} catch(EOFException ex) {
+		scontext->set_continuation(false);
+		parser.finish(quit);
+	}
+	scontext->session().sync();
+	return parser.any_dispatched() ? parser.result_code() : COMERR_UNKNOWN;
+}
+
+/*
+ * Compiling a script splits it into commands, tokenizes them and resolves
+ * their names once.  Commands that fail to tokenize or resolve are kept as
+ * source text and handed to eval_command when reached, so they report the
+ * same errors at the same point as they would have when interpreted.
+ */
+class ScriptCompiler : public CommandParser
 {
-	char **commands;
-	int i, result = 0;
-    char buf[strlen(expr.c_str()) + 1];
+	CompiledScript& script;
 
-    strcpy(buf, expr.c_str());
-	g_strdelimit(buf, "\r\n;", ';');
-	commands = g_strsplit(buf, ";", 0);
-	for(i = quit = 0; !quit && commands[i]; i++)
-		result = eval_command(scontext, commands[i], quit, interactive);
-	g_strfreev(commands);
+protected:
+	virtual int command(const string& expr, int& quit)
+	{
+		CompiledScript::Instruction ins;
+		bool completed, ambiguous;
+
+		quit = 0;
+		ins.line = expr;
+		ins.command = 0;
+		tokenize(ins.line, completed, ins.args, ins.offsets);
+		if(completed && !ins.args.size())
+			return 0;
+		if(completed)
+			ins.command = command_lookup(ins.args[0], ambiguous);
+		script.instructions.push_back(ins);
+		return 0;
+	}
+
+public:
+	ScriptCompiler(CompiledScript& _script) : CommandParser(0, false), script(_script) { }
+	virtual ~ScriptCompiler() { }
+};
+
+void CompiledScript::compile(const string& text)
+{
+	ScriptCompiler compiler(*this);
+	int quit;
+
+	instructions.clear();
+	compiler.feed(text, quit);
+	compiler.finish(quit);
+}
+
+int CompiledScript::run(ScriptContext *scontext, int& quit, bool interactive) const
+{
+	AutoBatch batch(scontext);
+	int result = 0;
+
+	quit = 0;
+	for(vector<Instruction>::const_iterator i = instructions.begin(); !quit && i != instructions.end(); i++) {
+		if(!i->command) {
+			result = eval_command(scontext, i->line, quit, interactive);
+			continue;
+		}
+
+		CommandContext context(scontext);
+
+		context.session.dispatch();
+		context.line = i->line.c_str();
+		context.args = i->args;
+		context.offsets = i->offsets;
+		result = execute_command(i->command, context, quit, interactive);
+	}
+	scontext->session().sync();
 	return result;
 }
 
+class CachedScript
+{
+public:
+	time_t mtime;
+	off_t size;
+	int running;
+	bool replaced;
+	CompiledScript script;
+
+	CachedScript() : running(0), replaced(false) { }
+};
+
+static map<string, CachedScript *> script_cache;
+
+/*
+ * Marks a cached script as being run, so that recompiling it (a script
+ * that sources itself after changing) frees it only once it has finished.
+ */
+class RunningScript
+{
+	CachedScript *cached;
+
+public:
+	RunningScript(CachedScript *c) : cached(c) { cached->running++; }
+	~RunningScript()
+	{
+		if(!--cached->running && cached->replaced)
+			delete cached;
+	}
+};
+
+static CachedScript *cached_script(const string& path);
+
+/*
+ * Returns the compiled form of the script at path, compiling it only if it
+ * is not cached or has changed since it was.  Returns 0 with errno set if
+ * the file cannot be read.  The result is freed when the script is next
+ * recompiled, unless eval_file is running it.
+ */
+const CompiledScript *script_compile(const string& path)
+{
+	CachedScript *cached = cached_script(path);
+
+	return cached ? &cached->script : 0;
+}
+
+static CachedScript *cached_script(const string& path)
+{
+	map<string, CachedScript *>::iterator i = script_cache.find(path);
+	struct stat st;
+
+	if(stat(path.c_str(), &st) < 0)
+		return 0;
+	if(i != script_cache.end() && i->second->mtime == st.st_mtime && i->second->size == st.st_size)
+		return i->second;
+
+	FILE *f = fopen(path.c_str(), "r");
+
+	if(!f)
+		return 0;
+
+	string text;
+	char buf[8192];
+	size_t n;
+
+	text.reserve(st.st_size);
+	while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		text.append(buf, n);
+	if(ferror(f)) {
+		int err = errno;
+
+		fclose(f);
+		errno = err;
+		return 0;
+	}
+	fclose(f);
+	// A stale entry may still be running, so it is replaced rather than
+	// recompiled in place.
+	if(i == script_cache.end())
+		i = script_cache.insert(make_pair(path, (CachedScript *) 0)).first;
+	else if(i->second->running)
+		i->second->replaced = true;
+	else
+		delete i->second;
+	i->second = new CachedScript();
+	i->second->mtime = st.st_mtime;
+	i->second->size = st.st_size;
+	i->second->script.compile(text);
+	return i->second;
+}
+
+int eval_file(ScriptContext *scontext, const string& path, int& quit, bool interactive)
+{
+	CachedScript *cached = cached_script(path);
+
+	quit = 0;
+	if(!cached) {
+		fprintf(stderr, "Unable to read `%s': %s\n", path.c_str(), strerror(errno));
+		return COMERR_UNKNOWN;
+	}
+
+	RunningScript running(cached);
+
+	return cached->script.run(scontext, quit, interactive);
+}
@@ -1,38 +1,42 @@
-#include <glib.h>
-#include <string.h>
 #include "formatter.h"
+#include <algorithm>
 
-Formatter::Formatter()
+FormatTemplate::FormatTemplate(const string& fmt)
 {
-    associate('%', "%");
+    compile(fmt);
 }
 
-Formatter::~Formatter()
+void FormatTemplate::compile(const string& fmt)
 {
-}
-
-void Formatter::associate(char id, const string value)
-{
-    dissociate(id);
-    values[id] = string(value);
-}
-
-void Formatter::dissociate(char id)
-{
-    values[id] = string();
-}
+    string::size_type start = 0, p;
 
-string Formatter::expand(const string format) const
-{
-    string result;
+    format = fmt;
+    segments.clear();
+    specifiers.clear();
+    while((p = format.find('%', start)) != string::npos && p + 1 < format.size()) {
+        char id = format[p + 1];
 
-    for(unsigned i = 0; i < format.size(); i++) {
-        if(format[i] == '%') {
-            result.append(values[(char) format[++i]]);
+        if(id == '%') {
+            segments.push_back(Segment(-1, start, p + 1 - start));
         } else {
-            result.append(1, format[i]);
+            vector<char>::iterator s = find(specifiers.begin(), specifiers.end(), id);
+
+            if(p > start) {
+                segments.push_back(Segment(-1, start, p - start));
+            }
+            if(s == specifiers.end()) {
+                s = specifiers.insert(s, id);
+            }
+            segments.push_back(Segment(s - specifiers.begin(), 0, 0));
         }
+        start = p + 2;
+    }
+    if(start < format.size()) {
+        segments.push_back(Segment(-1, start, format.size() - start));
     }
-    return result;
 }
 
+bool FormatTemplate::uses(char id) const
+{
+    return find(specifiers.begin(), specifiers.end(), id) != specifiers.end();
+}
@@ -5,9 +5,12 @@
 #include <set>
 #include <string.h>
 #include <cctype>
+#include <time.h>
 #include "config.h"
 #include "command.h"
 #include "output.h"
+#include "util.h"
+#include "watch.h"
 
 class QuitCommand : public Command
 {
@@ -40,50 +43,43 @@ public:
 
 	virtual void execute(CommandContext &context) const
 	{
-        Session session = context.session;
-		string title;
-		gint32 leftVol, rightVol, pos, rate, freq, nch, t, i;
-#if HAVE_XMMS_REMOTE_GET_EQ
-		float preamp;
-        vector<float> bands;
-#endif
-        Playlist playlist = session.get_playlist();
-
-		pos = playlist.position();
-        title = playlist.title(pos);
-        if(session.is_playing()) {
-            session.get_playback_info(rate, freq, nch);
-            t = session.get_playback_time();
-			printf("Playing: %s (%d kbps, %d hz, %d channels)\n", title.size() ? title.c_str() : "<no title>", rate / 1000, freq, nch);
+		const Session::Snapshot state = context.session.snapshot();
+		const string& title = state.title;
+		gint32 t = state.time, i;
+
+		if(!state.running)
+			throw XmmsNotRunningException(context.session);
+		if(state.playing) {
+			printf("Playing: %s (%d kbps, %d hz, %d channels)\n", title.size() ? title.c_str() : "<no title>", state.rate / 1000, state.freq, state.nch);
 			printf("Time: %02d:%02d.%02d%s\n", t / 60000, (t / 1000) % 60, (t / 10) % 100,
-					session.is_paused() ? " (paused)" : "");
+					state.paused ? " (paused)" : "");
 		} else
 			printf("Current song: %s\n", title.size() ? title.c_str() : "<no track selected>");
-        session.get_volume(leftVol, rightVol);
 #if HAVE_XMMS_REMOTE_IS_REPEAT
-		printf("Repeat mode: %s\n", session.is_repeat() ? "on" : "off");
+		printf("Repeat mode: %s\n", state.repeat ? "on" : "off");
 #endif
 #if HAVE_XMMS_REMOTE_IS_SHUFFLE
-		printf("Shuffle mode: %s\n", session.is_shuffle() ? "on" : "off");
+		printf("Shuffle mode: %s\n", state.shuffle ? "on" : "off");
 #endif
-		printf("Balance: %d\n", session.get_balance());
-		printf("Skin: %s\n", session.get_skin().c_str());
-		printf("Left volume: %d\n", leftVol);
-		printf("Right volume: %d\n", rightVol);
+		printf("Balance: %d\n", state.balance);
+		printf("Skin: %s\n", state.skin.c_str());
+		printf("Left volume: %d\n", state.left);
+		printf("Right volume: %d\n", state.right);
 #if HAVE_XMMS_REMOTE_GET_EQ
-        session.get_eq(preamp, bands);
-		printf("Equalizer preamp: %.1f\n", preamp);
-		printf("Equalizer bands:");
-		for(i = 0; i < 10; i++)
-			printf("%5d", i);
-		printf("\n");
-		printf("                  ");
-		for(i = 0; i < 10; i++)
-			if(bands[i] < 0)
-				printf(" %3.1f", bands[i]);
-			else
-				printf("  %3.1f", bands[i]);
-		printf("\n");
+		if(state.bands.size() == 10) {
+			printf("Equalizer preamp: %.1f\n", state.preamp);
+			printf("Equalizer bands:");
+			for(i = 0; i < 10; i++)
+				printf("%5d", i);
+			printf("\n");
+			printf("                  ");
+			for(i = 0; i < 10; i++)
+				if(state.bands[i] < 0)
+					printf(" %3.1f", state.bands[i]);
+				else
+					printf("  %3.1f", state.bands[i]);
+			printf("\n");
+		}
 #endif
 		context.result_code = COMRES_SUCCESS;
 	}
@@ -386,7 +382,10 @@ public:
             cnx.result_code = COMERR_SYNTAX;
             return;
         }
-        system(cnx.raw[1].c_str());
+        // The command may depend on what has been held back, e.g. PLAY
+        // followed by EXEC sleep.
+        cnx.session.flush();
+        system(cnx.raw(1));
     }
 
     COM_SYNOPSIS("executes a system command")
@@ -397,6 +396,202 @@ public:
     COM_RETURN("Always 0")
 };
 
+class StatsCommand : public Command
+{
+public:
+	COM_STRUCT(StatsCommand, "stats")
+
+	virtual void execute(CommandContext &cnx) const
+	{
+		const Session::Statistics& stats = cnx.session.statistics();
+
+		printf("Commands executed: %lu\n", stats.commands);
+		printf("XMMS connections: %lu", stats.connects);
+		if(stats.commands) {
+			printf(" (%.2f per command)", (double) stats.connects / stats.commands);
+		}
+		printf("\n");
+		printf("Reconnects: %lu\n", stats.reconnects);
+
+		const PlaylistCache::Statistics& cache = cnx.session.playlist_cache().statistics();
+
+		printf("Playlist cache: %lu hits, %lu misses, %lu checks\n", cache.hits, cache.misses, cache.validations);
+		cnx.result_code = COMRES_SUCCESS;
+	}
+
+	COM_SYNOPSIS("display XMMS-Shell usage statistics")
+	COM_SYNTAX("STATS")
+	COM_DESCRIPTION(
+		"The STATS command displays how many commands have been executed during this "
+		"session and how many connections to XMMS were needed to execute them, as well "
+		"as how many playlist entries were served from XMMS-Shell's copy of the playlist "
+		"(hits) rather than fetched from XMMS (misses).  This is mostly useful for "
+		"measuring the cost of scripts."
+	)
+	COM_RETURN("Always 0")
+};
+
+class PollCommand : public Command
+{
+public:
+	COM_STRUCT(PollCommand, "poll")
+
+	virtual void execute(CommandContext &cnx) const
+	{
+		Watcher& watcher = cnx.session.watcher();
+
+		if(cnx.args.size() > 2) {
+			cnx.result_code = COMERR_SYNTAX;
+			return;
+		}
+		if(cnx.args.size() == 2) {
+			if(!strcasecmp(cnx.args[1].c_str(), "off"))
+				watcher.set_polling(false, watcher.get_interval());
+			else if(isdigit(cnx.args[1][0]) && atoi(cnx.args[1].c_str()) > 0)
+				watcher.set_polling(true, atoi(cnx.args[1].c_str()) / 1000.0);
+			else {
+				cnx.result_code = COMERR_SYNTAX;
+				return;
+			}
+		}
+		if(watcher.polling())
+			printf("Polling every %d ms at most\n", (int) (watcher.get_interval() * 1000 + 0.5));
+		else
+			printf("Polling is off\n");
+		cnx.result_code = COMRES_SUCCESS;
+	}
+
+	COM_SYNOPSIS("keep XMMS's state refreshed in the background")
+	COM_SYNTAX("POLL [<interval>|OFF]")
+	COM_DESCRIPTION(
+		"With an <interval> in milliseconds, starts a background thread that queries XMMS "
+		"at least that often, and more often as the end of the current track approaches.  "
+		"The prompt, STATUS and CURRENT-TRACK then show the latest state it has seen "
+		"instead of querying XMMS themselves, until a command talks to XMMS and so may "
+		"have changed something.  POLL OFF stops the polling; without arguments POLL shows "
+		"whether it is on."
+	)
+	COM_RETURN("Always 0")
+};
+
+class WaitForCommand : public Command
+{
+	enum { TRACK_CHANGE, STOPPED, TIME, POSITION };
+
+	static void sleep_until(double when)
+	{
+		struct timespec delay;
+		double now;
+
+		while((now = current_time()) < when) {
+			delay.tv_sec = (time_t) (when - now);
+			delay.tv_nsec = (long) ((when - now - delay.tv_sec) * 1e9);
+			nanosleep(&delay, 0);
+		}
+	}
+
+	static bool met(int condition, gint32 value, const Session::Snapshot& before, const Session::Snapshot& after)
+	{
+		switch(condition) {
+			case TRACK_CHANGE:
+				return (Watcher::changes(before, after) & Session::TRACK_CHANGE) != 0;
+			case STOPPED:
+				return !after.running || after.mode() == Session::STOPPED;
+			case TIME:
+				return after.running && after.playing && after.time >= value;
+			case POSITION:
+				return after.running && after.position == value;
+		}
+		return false;
+	}
+
+public:
+	COM_STRUCT(WaitForCommand, "wait-for")
+
+	virtual void execute(CommandContext &cnx) const
+	{
+		static const char *names[] = { "track-change", "stopped", "time", "position" };
+		Watcher& watcher = cnx.session.watcher();
+		Session::Snapshot before, after;
+		unsigned long generation;
+		double start, deadline = 0;
+		int condition = -1;
+		gint32 value = 0;
+		unsigned i = 2;
+
+		for(int c = 0; c < 4; c++) {
+			if(cnx.args.size() > 1 && !strcasecmp(cnx.args[1].c_str(), names[c]))
+				condition = c;
+		}
+		if(condition == TIME || condition == POSITION) {
+			if(cnx.args.size() < 3 || !isdigit(cnx.args[2][0])) {
+				cnx.result_code = COMERR_SYNTAX;
+				return;
+			}
+			value = atoi(cnx.args[2].c_str());
+			i++;
+		}
+		if(condition >= 0 && cnx.args.size() == i + 2 && !strcasecmp(cnx.args[i].c_str(), "timeout") && isdigit(cnx.args[i + 1][0]))
+			deadline = current_time() + atoi(cnx.args[i + 1].c_str()) / 1000.0;
+		else if(condition < 0 || cnx.args.size() != i) {
+			cnx.result_code = COMERR_SYNTAX;
+			return;
+		}
+
+		// Requests held back by BEGIN could be what is being waited for.
+		cnx.session.flush();
+		start = current_time();
+		// A poll already in flight started before us and does not count.
+		generation = 0;
+		do {
+			generation = watcher.wait(generation, deadline, after);
+		} while(after.taken < start && !(deadline && current_time() >= deadline));
+		cnx.result_code = COMERR_TIMEOUT;
+		while(after.taken >= start) {
+			if(met(condition, value, before, after)) {
+				cnx.result_code = COMRES_SUCCESS;
+				break;
+			}
+			if(deadline && current_time() >= deadline)
+				break;
+			/*
+			 * The time played advances predictably, so sleep until the
+			 * moment it should be reached without asking XMMS anything,
+			 * then check with one poll of our own.  The other conditions
+			 * are left to the watcher, which polls faster as the end of the
+			 * track approaches.
+			 */
+			if(condition == TIME && after.running && after.mode() == Session::PLAYING) {
+				double when = after.taken + (value - after.time) / 1000.0;
+
+				if(when < after.taken + WATCH_MIN_INTERVAL)
+					when = after.taken + WATCH_MIN_INTERVAL;
+				sleep_until(deadline && deadline < when ? deadline : when);
+				before = after;
+				after = Session::poll(cnx.session.get_id(), Session::Snapshot::PLAY_MODE | Session::Snapshot::TIME);
+				continue;
+			}
+			before = after;
+			generation = watcher.wait(generation, deadline, after);
+			if(after.taken == before.taken)
+				break;
+		}
+	}
+
+	COM_SYNOPSIS("wait until XMMS reaches a given state")
+	COM_SYNTAX("WAIT-FOR TRACK-CHANGE|STOPPED|TIME <ms>|POSITION <n> [TIMEOUT <ms>]")
+	COM_DESCRIPTION(
+		"Blocks until the next track starts (TRACK-CHANGE), playback is stopped (STOPPED), "
+		"the time played in the current track reaches <ms> milliseconds (TIME) or track "
+		"<n> of the playlist is current (POSITION).  STOPPED, TIME and POSITION return at "
+		"once if the condition already holds.  With TIMEOUT, gives up after <ms> "
+		"milliseconds.  For TIME, WAIT-FOR sleeps until the moment the time played should "
+		"reach <ms> and only then asks XMMS; otherwise XMMS is polled, more often as the end "
+		"of the current track approaches."
+	)
+	COM_RETURN("0 once the condition is met, 122 on timeout, 125 on a syntax error")
+};
+
 static Command *commands[] = {
 	new StatusCommand(),
 	new QuitCommand(),
@@ -405,6 +600,9 @@ static Command *commands[] = {
 	new EchoCommand(),
 	new XMMSQuitCommand(),
     new ExecCommand(),
+	new StatsCommand(),
+	new PollCommand(),
+	new WaitForCommand(),
 };
 
 void general_init(void)
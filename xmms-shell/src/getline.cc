@@ -25,31 +25,16 @@ static gchar *stripwhite(gchar *line)
 
 static char *build_command_list(char **argv, int arg, int state)
 {
-	static int index;
+	static vector<string> names;
 	const char *com = argv[arg];
-	static char **commands;
 
-	if(!commands) {
-		const vector<CommandReference> cl = command_list();
-		int i = 0;
-
-		commands = (char **)malloc((cl.size() + 1) * sizeof(char *));
-		for(vector<CommandReference>::const_iterator p = cl.begin(); p != cl.end(); p++)
-			commands[i++] = g_strdup((*p).get_name().c_str());
-		commands[i] = 0;
+	if(!state) {
+		names.clear();
+		command_complete(com ? com : "", names);
 	}
-	if(!com)
-		com = "";
-	if(!state)
-		index = 0;
-	else
-		if(commands[index])
-			index++;
-	while(commands[index] && g_strncasecmp(commands[index], com, strlen(com)))
-		index++;
-	if(!commands[index])
+	if(state >= (int) names.size())
 		return 0;
-	return commands[index];
+	return (char *) names[state].c_str();
 }
 
 static void free_vector(char **vec)
@@ -208,6 +193,25 @@ static int char_is_quoted(char *text, int index)
 	return index && text[index - 1] == '\\' && !char_is_quoted(text, index - 1);
 }
 
+static int (*idle_pending)(void);
+static int (*idle_run)(void);
+
+/*
+ * Readline calls this several times a second while it waits for a key.
+ * The idle function returns nonzero if it printed anything, having first
+ * moved off the prompt line; the prompt and the partial input are then
+ * redrawn below its output.
+ */
+static int event_hook(void)
+{
+	if(idle_pending && idle_pending() && idle_run()) {
+		fflush(stdout);
+		rl_on_new_line();
+		rl_redisplay();
+	}
+	return 0;
+}
+
 gchar *getline(char *prompt)
 {
 	static char *line;
@@ -237,10 +241,21 @@ static void getline_rl_init(void)
 	rl_filename_quoting_function = filename_quote;
 	rl_filename_dequoting_function = filename_dequote;
 	rl_char_is_quoted_p = char_is_quoted;
+	rl_event_hook = event_hook;
+}
+
+void getline_set_idle(int (*pending)(void), int (*run)(void))
+{
+	idle_pending = pending;
+	idle_run = run;
 }
 
 #else
 
+void getline_set_idle(int (*pending)(void), int (*run)(void))
+{
+}
+
 gchar *getline(gchar *prompt)
 {
 	static char line[4096];
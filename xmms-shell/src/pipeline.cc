@@ -0,0 +1,105 @@
+#include "config.h"
+#include "pipeline.h"
+#include <xmmsctrl.h>
+
+class StringFetchJob : public PipelineJob
+{
+    gchar *(*request)(gint, gint);
+    int start;
+    vector<string>& results;
+
+public:
+    StringFetchJob(gchar *(*_request)(gint, gint), int _start, vector<string>& _results)
+        : request(_request), start(_start), results(_results) { }
+
+    virtual void run(gint32 sid, int index)
+    {
+        gchar *c_str = request(sid, index);
+
+        if(c_str) {
+            results[index - start] = c_str;
+            g_free(c_str);
+        }
+    }
+};
+
+Pipeline::Pipeline(const Session& _session, int _depth, int _chunk)
+    : session(_session), depth(_depth), chunk(_chunk), job(0), next(0), end(0)
+{
+    pthread_mutex_init(&lock, 0);
+}
+
+Pipeline::~Pipeline()
+{
+    pthread_mutex_destroy(&lock);
+}
+
+bool Pipeline::claim(int& from, int& to)
+{
+    bool claimed;
+
+    pthread_mutex_lock(&lock);
+    from = next;
+    to = next + chunk < end ? next + chunk : end;
+    next = to;
+    claimed = from < to;
+    pthread_mutex_unlock(&lock);
+    return claimed;
+}
+
+void *Pipeline::worker(void *arg)
+{
+    Pipeline *pipeline = (Pipeline *) arg;
+    gint32 sid = pipeline->session.get_id();
+    int from, to;
+
+    while(pipeline->claim(from, to)) {
+        for(int i = from; i < to; i++) {
+            pipeline->job->run(sid, i);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Runs job for every index in [start, end).  The caller must already have
+ * talked to XMMS once from this thread: libxmms looks up the socket path
+ * through glib's lazily initialised user/tmpdir cache, which is not safe
+ * to fill in from several threads at once.
+ */
+void Pipeline::run(PipelineJob& _job, int start, int _end)
+{
+    int n = (_end - start + chunk - 1) / chunk;
+    vector<pthread_t> threads;
+    pthread_t thread;
+
+    if(_end <= start) {
+        return;
+    }
+    session.remote_id(_end - start);
+    job = &_job;
+    next = start;
+    end = _end;
+    if(n > depth) {
+        n = depth;
+    }
+    for(int i = 1; i < n; i++) {
+        if(pthread_create(&thread, 0, worker, this)) {
+            break;
+        }
+        threads.push_back(thread);
+    }
+    worker(this);
+    for(vector<pthread_t>::iterator i = threads.begin(); i != threads.end(); i++) {
+        pthread_join(*i, 0);
+    }
+    job = 0;
+}
+
+void Pipeline::fetch_strings(gchar *(*request)(gint, gint), int start, int end, vector<string>& results)
+{
+    StringFetchJob fetch(request, start, results);
+
+    results.assign(end > start ? end - start : 0, string());
+    run(fetch, start, end);
+}
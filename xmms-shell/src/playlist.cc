@@ -6,9 +6,18 @@
 #include <cctype>
 #include <string.h>
 #include <strings.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <algorithm>
+#include <sys/stat.h>
 #include <xmmsctrl.h>
 #include "config.h"
 #include "command.h"
+#include "dirscan.h"
+#include "pipeline.h"
+#include "playlistfile.h"
+#include "util.h"
 
 #define SECTION virtual const string get_section(void) const { return "Playlist"; }
 
@@ -23,10 +32,26 @@ public:
         Playlist playlist = session.get_playlist();
         int pos;
 
-        if(cnx.args.size() < 2 || !isdigit(cnx.args[1][0])) {
+        if(cnx.args.size() < 2) {
             cnx.result_code = COMERR_SYNTAX;
             return;
         }
+        if(!isdigit(cnx.args[1][0])) {
+            string text;
+
+            for(unsigned i = 1; i < cnx.args.size(); i++) {
+                text += cnx.args[i];
+            }
+            if(!(pos = playlist.fuzzy_search(text))) {
+                printf("No playlist entry matches `%s'.\n", text.c_str());
+                cnx.result_code = COMERR_NOEFFECT;
+                return;
+            }
+            playlist.set_position(pos);
+            printf("Jumped to position %d in the playlist: %s\n", pos, playlist.title(pos).c_str());
+            cnx.result_code = 0;
+            return;
+        }
         pos = atoi(cnx.args[1].c_str());
         try {
             playlist.set_position(pos);
@@ -39,14 +64,17 @@ public:
     }
 
     COM_SYNOPSIS("jump to a position in the playlist")
-    COM_SYNTAX("JUMP <position>")
+    COM_SYNTAX("JUMP <position> | JUMP <text>")
     COM_DESCRIPTION(
         "The JUMP command instructs XMMS to move to a given position in the "
         "playlist.  Positions are specified as numbers.  The first file in the "
-        "playlist is position 1.  If XMMS is playing when the JUMP command is "
-        "executed then playback will continue immediately on the new file."
+        "playlist is position 1.  If text is given instead of a number, JUMP moves "
+        "to the entry whose title best matches it: the characters of the text must "
+        "appear in the title in order, though not necessarily together, so that for "
+        "example `jump bohrhap' finds Bohemian Rhapsody.  If XMMS is playing when the "
+        "JUMP command is executed then playback will continue immediately on the new file."
     )
-    COM_RETURN("Always 0")
+    COM_RETURN("0, or COMERR_NOEFFECT if no title matches the given text")
     SECTION
 };
 
@@ -174,6 +202,13 @@ public:
     SECTION
 };
 
+/*
+ * LIST fetches and prints the requested range a window at a time, so only
+ * the entries actually displayed are transferred and output starts before
+ * a long listing has been fetched completely.
+ */
+#define LIST_WINDOW 1024
+
 class ListCommand : public Command
 {
 public:
@@ -184,7 +219,7 @@ public:
         Session session = cnx.session;
         Playlist playlist = session.get_playlist();
         vector<string> list;
-        int start = 0, stop = -1, x = 1, digs, pos;
+        int start = 0, stop = -1, x = 1, digs, pos, len;
         bool filenames = false;
 
         if(cnx.args.size() > 1 && !strncasecmp("filenames", cnx.args[1].c_str(), cnx.args[1].length())) {
@@ -205,20 +240,34 @@ public:
                 stop = atoi(cnx.args[x + 1].c_str()) - 1;
             }
         }
-        if(filenames) {
-            list = playlist.filenames();
-        } else {
-            list = playlist.titles();
+        len = playlist.length();
+        if(!len) {
+            printf("Playlist is empty\n");
+            cnx.result_code = 0;
+            return;
+        }
+        if(stop == -1 || stop >= len) {
+            stop = len - 1;
+        }
+        if(start < 0) {
+            start = 0;
         }
         pos = playlist.position();
-        if(list.size()) {
-            for(int i = digs = 1; i < (int) list.size(); i *= 10, digs++);
-            for(int i = start; i < (int) list.size() && (stop == -1 || i <= stop); i++)
-                printf("%c%*d. %s\n", pos == i + 1 ? '*' : ' ', digs, i + 1, list[i].c_str());
-        } else {
-            printf("Playlist is empty\n");
+        for(int i = digs = 1; i < len; i *= 10, digs++);
+        cnx.result_code = 0;
+        for(int i = start; i <= stop; i += LIST_WINDOW) {
+            int last = i + LIST_WINDOW - 1 < stop ? i + LIST_WINDOW - 1 : stop;
+
+            if(filenames) {
+                list = playlist.filenames(i + 1, last + 1);
+            } else {
+                list = playlist.titles(i + 1, last + 1);
+            }
+            for(int j = 0; j < (int) list.size(); j++) {
+                printf("%c%*d. %s\n", pos == i + j + 1 ? '*' : ' ', digs, i + j + 1, list[j].c_str());
+            }
+            cnx.result_code += list.size();
         }
-        cnx.result_code = (stop != -1 && stop < (int) list.size() ? stop + 1 : list.size()) - start;
     }
 
     COM_SYNOPSIS("display the playlist")
@@ -236,21 +285,93 @@ public:
     SECTION
 };
 
-int Playlist::load(vector<string>::const_iterator start, vector<string>::const_iterator end)
+/*
+ * Filenames are handed to XMMS in batches of PLAYLIST_LOAD_BATCH.  This
+ * keeps memory flat, and XMMS never has to swallow one enormous request.
+ * Each batch is built by prepending and then reversed once, so building
+ * it is linear.
+ */
+PlaylistLoader::PlaylistLoader(const Session& _session, int _total)
+    : session(_session), batch(0), pending(0), loaded(0), total(_total), progress(0), progress_data(0)
+{
+}
+
+PlaylistLoader::~PlaylistLoader()
 {
+    discard();
+}
+
+void PlaylistLoader::discard(void)
+{
+    for(GList *p = batch; p; p = p->next) {
+        g_free(p->data);
+    }
+    g_list_free(batch);
+    batch = 0;
+    pending = 0;
+}
+
+void PlaylistLoader::set_progress(LoadProgress _progress, void *data)
+{
+    progress = _progress;
+    progress_data = data;
+}
+
+void PlaylistLoader::add(const char *filename, int length)
+{
+    batch = g_list_prepend(batch, g_strndup(filename, length));
+    if(++pending >= PLAYLIST_LOAD_BATCH) {
+        flush();
+    }
+}
+
+void PlaylistLoader::add(const string& filename)
+{
+    add(filename.data(), filename.size());
+}
+
+void PlaylistLoader::flush(void)
+{
+    if(!pending) {
+        return;
+    }
     session.ensure_running();
+    batch = g_list_reverse(batch);
+    xmms_remote_playlist_add(session.remote_id(), batch);
+    loaded += pending;
+    discard();
+    session.playlist_cache().appended();
+    if(progress) {
+        progress(loaded, total, progress_data);
+    }
+}
+
+int PlaylistLoader::count(void) const
+{
+    return loaded;
+}
 
-    GList *list = 0;
-    int n = 0;
+int Playlist::load(vector<string>::const_iterator start, vector<string>::const_iterator end, LoadProgress progress, void *data)
+{
+    PlaylistLoader loader(session, end - start);
 
+    loader.set_progress(progress, data);
     while(start != end) {
-        list = g_list_append(list, g_strdup(start->c_str()));
-        start++;
-        n++;
+        loader.add(*start++);
     }
-    xmms_remote_playlist_add(session.get_id(), list);
-    g_list_free(list);
-    return n;
+    loader.flush();
+    return loader.count();
+}
+
+static void load_progress(int loaded, int total, void *data)
+{
+    if(total > 0) {
+        fprintf(stderr, "\rLoading: %d of %d files", loaded, total);
+    } else {
+        fprintf(stderr, "\rLoading: %d files", loaded);
+    }
+    fflush(stderr);
+    *(bool *) data = true;
 }
 
 class LoadCommand : public Command
@@ -261,24 +382,57 @@ public:
     virtual void execute(CommandContext &cnx) const
     {
         Session session = cnx.session;
-        Playlist playlist = session.get_playlist();
+        PlaylistLoader loader(session);
         vector<string>::const_iterator i = cnx.args.begin();
+        bool recursive = false, progress = false;
+        struct stat st;
 
-        if(cnx.args.size() < 2) {
+        if(cnx.args.size() > 1 && cnx.args[1] == "-r") {
+            recursive = true;
+            i++;
+        }
+        if(cnx.args.end() - i < 2) {
             cnx.result_code = COMERR_SYNTAX;
             return;
         }
-        i++;
-        cnx.result_code = playlist.load(i, cnx.args.end());
+        if(isatty(fileno(stderr))) {
+            loader.set_progress(load_progress, &progress);
+        }
+        while(++i != cnx.args.end()) {
+            if(recursive && !stat(i->c_str(), &st) && S_ISDIR(st.st_mode)) {
+                vector<string> roots(1, *i), files;
+                string extensions = cnx.context->has_env("LOAD_EXTENSIONS") ? cnx.context->get_env("LOAD_EXTENSIONS") : DIRSCAN_EXTENSIONS;
+
+                directory_scan(roots, extensions, files);
+                for(vector<string>::const_iterator f = files.begin(); f != files.end(); f++) {
+                    loader.add(*f);
+                }
+            } else if(!playlist_file_is_playlist(*i)) {
+                loader.add(*i);
+            } else if(playlist_file_load(loader, *i) < 0) {
+                fprintf(stderr, "Unable to read `%s': %s\n", i->c_str(), strerror(errno));
+            }
+        }
+        loader.flush();
+        cnx.result_code = loader.count();
+        if(progress) {
+            fprintf(stderr, "\n");
+        }
         printf("Loaded %d file%s\n", cnx.result_code, cnx.result_code - 1 ? "s" : "");
     }
 
     COM_SYNOPSIS("add music or playlist files to the playlist")
-    COM_SYNTAX("LOAD filename...")
+    COM_SYNTAX("LOAD [-r] filename...")
     COM_DESCRIPTION(
         "Attempts to load each of the filenames given as arguments.  If a file is "
         "a playlist file, the files specified within that playlist file are each "
-        "appended to the playlist.  Otherwise the file itself is appended to the playlist."
+        "appended to the playlist.  Otherwise the file itself is appended to the playlist.  "
+        "Playlist files ending in .m3u (plain or extended) or .pls are read by XMMS-Shell "
+        "itself and streamed to XMMS in batches, so arbitrarily large playlist files can "
+        "be loaded.  With -r, directories are searched recursively by XMMS-Shell "
+        "rather than by XMMS, and every file found with a known audio extension is "
+        "appended in sorted order.  The extensions may be changed by setting "
+        "LOAD_EXTENSIONS to a comma separated list, such as mp3,ogg,flac."
     )
     COM_RETURN("The number of successfully loaded")
     SECTION
@@ -380,20 +534,18 @@ public:
 
     virtual void execute(CommandContext &cnx) const
     {
-        Session session = cnx.session;
-        Playlist playlist = session.get_playlist();
+        const Session::Snapshot state = cnx.session.snapshot(Session::Snapshot::TITLE);
 
-        if(playlist.length() == 0) {
+        if(!state.running) {
+            throw XmmsNotRunningException(cnx.session);
+        }
+        if(state.length == 0) {
             printf("The playlist is empty.\n");
             cnx.result_code = 0;
             return;
         }
-
-        int pos = playlist.position();
-        string title = playlist.title(pos);
-
-        printf("Current song: %d. %s\n", pos, title.c_str());
-        cnx.result_code = pos;
+        printf("Current song: %d. %s\n", state.position, state.title.c_str());
+        cnx.result_code = state.position;
     }
 
     COM_SYNOPSIS("display current track")
@@ -415,20 +567,31 @@ public:
     {
         Session session = cnx.session;
         Playlist playlist = session.get_playlist();
+        vector<pair<int, int> > ranges;
         int pos, pos2;
+        char *end;
 
-        if(cnx.args.size() < 2 || !isdigit(cnx.args[1][0])) {
+        if(cnx.args.size() < 2) {
             cnx.result_code = COMERR_SYNTAX;
             return;
         }
-        pos = atoi(cnx.args[1].c_str());
-        if(cnx.args.size() > 2 && isdigit(cnx.args[2][0])) {
-            pos2 = atoi(cnx.args[2].c_str());
-        } else {
-            pos2 = pos;
+        for(vector<string>::const_iterator i = cnx.args.begin() + 1; i != cnx.args.end(); i++) {
+            if(!isdigit((*i)[0])) {
+                cnx.result_code = COMERR_SYNTAX;
+                return;
+            }
+            pos = pos2 = strtol(i->c_str(), &end, 10);
+            if(*end == '-' && isdigit(end[1])) {
+                pos2 = strtol(end + 1, &end, 10);
+            }
+            if(*end) {
+                cnx.result_code = COMERR_SYNTAX;
+                return;
+            }
+            ranges.push_back(pair<int, int>(pos, pos2));
         }
         try {
-            cnx.result_code = playlist.remove(pos, pos2);
+            cnx.result_code = playlist.remove(ranges);
         } catch(PlaylistPositionOutOfBoundsException ex) {
             fprintf(stderr, "%s\n", ex.to_string().c_str());
             cnx.result_code = COMERR_SYNTAX;
@@ -437,19 +600,144 @@ public:
     }
 
     COM_SYNOPSIS("remove track(s) from the playlist")
-    COM_SYNTAX("REMOVE pos [pos2]")
+    COM_SYNTAX("REMOVE pos[-pos2]...")
     COM_DESCRIPTION(
-        "The REMOVE command removes a track or range of tracks from the playlist.  "
-        "The first parameter given specifies the position of the first track to "
-        "remove.  If no second parameter is given, only the track at the given "
-        "position is removed.  If the second parameter is given, and pos2 >= pos1, "
-        "then all tracks with positions between pos and pos2 inclusive are removed "
-        "from the playlist."
+        "The REMOVE command removes tracks from the playlist.  Each argument is "
+        "either a single position, which removes the track at that position, or a "
+        "range written as pos-pos2, which removes all tracks with positions between "
+        "pos and pos2 inclusive.  Several positions and ranges may be given at once, "
+        "for example REMOVE 10-20 400-900 35.  All positions refer to the playlist "
+        "as it was before the command."
     )
     COM_RETURN("The number of tracks removed from the playlist")
     SECTION
 };
 
+class RemoveMatchingCommand : public Command
+{
+public:
+    RemoveMatchingCommand() : Command("remove-matching") { }
+
+    virtual void execute(CommandContext &cnx) const
+    {
+        Session session = cnx.session;
+        Playlist playlist = session.get_playlist();
+        vector<string> list;
+        vector<pair<int, int> > ranges;
+        bool filenames = false, glob = false;
+        unsigned x = 1;
+        regex_t re;
+        int err;
+
+        if(x < cnx.args.size() - 1 && !strncasecmp("filenames", cnx.args[x].c_str(), cnx.args[x].length())) {
+            filenames = true;
+            x++;
+        }
+        if(x < cnx.args.size() - 1 && !strcasecmp("glob", cnx.args[x].c_str())) {
+            glob = true;
+            x++;
+        }
+        if(x != cnx.args.size() - 1) {
+            cnx.result_code = COMERR_SYNTAX;
+            return;
+        }
+
+        const char *pattern = cnx.args[x].c_str();
+
+        if(!glob && (err = regcomp(&re, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB))) {
+            char buf[256];
+
+            regerror(err, &re, buf, sizeof(buf));
+            fprintf(stderr, "Invalid pattern `%s': %s\n", pattern, buf);
+            cnx.result_code = COMERR_SYNTAX;
+            return;
+        }
+        list = filenames ? playlist.filenames() : playlist.titles();
+        for(int i = 0; i < (int) list.size(); i++) {
+            bool match;
+
+            if(glob) {
+                match = !fnmatch(pattern, list[i].c_str(), FNM_CASEFOLD);
+            } else {
+                match = !regexec(&re, list[i].c_str(), 0, 0, 0);
+            }
+            if(!match) {
+                continue;
+            }
+            if(ranges.size() && ranges.back().second == i) {
+                ranges.back().second = i + 1;
+            } else {
+                ranges.push_back(pair<int, int>(i + 1, i + 1));
+            }
+        }
+        if(!glob) {
+            regfree(&re);
+        }
+        cnx.result_code = ranges.size() ? playlist.remove(ranges) : 0;
+        printf("Removed %d entr%s\n", cnx.result_code, cnx.result_code == 1 ? "y" : "ies");
+    }
+
+    COM_SYNOPSIS("remove all tracks matching a pattern from the playlist")
+    COM_SYNTAX("REMOVE-MATCHING [FILENAMES] [GLOB] <pattern>")
+    COM_DESCRIPTION(
+        "The REMOVE-MATCHING command removes every entry of the playlist whose title "
+        "matches the given pattern.  If FILENAMES is specified, filenames are matched "
+        "instead of titles.  The pattern is a case-insensitive extended regular "
+        "expression, which may match anywhere in the title or filename.  If GLOB is "
+        "specified, the pattern is instead a shell wildcard pattern that must match the "
+        "whole title or filename, such as http://* or /music/old/*."
+    )
+    COM_RETURN("The number of tracks removed from the playlist")
+    SECTION
+};
+
+class SearchCommand : public Command
+{
+public:
+    COM_STRUCT(SearchCommand, "search")
+
+    virtual void execute(CommandContext &cnx) const
+    {
+        Session session = cnx.session;
+        Playlist playlist = session.get_playlist();
+        vector<int> positions;
+        vector<string> titles;
+        string text;
+        int digs;
+
+        if(cnx.args.size() < 2) {
+            cnx.result_code = COMERR_SYNTAX;
+            return;
+        }
+        for(unsigned i = 1; i < cnx.args.size(); i++) {
+            if(i != 1) {
+                text += " ";
+            }
+            text += cnx.args[i];
+        }
+        positions = playlist.search(text, &titles);
+        for(int i = digs = 1; !positions.empty() && i < positions.back(); i *= 10, digs++);
+        for(unsigned i = 0; i < positions.size(); i++) {
+            printf(" %*d. %s\n", digs, positions[i], titles[i].c_str());
+        }
+        if(positions.empty()) {
+            printf("No matches for `%s'\n", text.c_str());
+        }
+        cnx.result_code = positions.size();
+    }
+
+    COM_SYNOPSIS("search the playlist")
+    COM_SYNTAX("SEARCH <text>")
+    COM_DESCRIPTION(
+        "The SEARCH command lists every entry of the playlist whose title or filename "
+        "contains the given text, ignoring case, together with its position, which may "
+        "be given to JUMP.  The first search reads the whole playlist and indexes it; "
+        "later searches only reindex the parts of the playlist that have changed."
+    )
+    COM_RETURN("The number of matching entries")
+    SECTION
+};
+
 static Command *commands[] = {
     new JumpCommand(),
     new NextCommand(),
@@ -461,6 +749,8 @@ static Command *commands[] = {
     new RandomTrackCommand(),
     new CurrentTrackCommand(),
     new RemoveCommand(),
+    new RemoveMatchingCommand(),
+    new SearchCommand(),
 };
 
 void playlist_init(void)
@@ -481,36 +771,36 @@ Playlist::~Playlist()
 void Playlist::clear(void) const
 {
     session.ensure_running();
-    xmms_remote_playlist_clear(session.get_id());
+    xmms_remote_playlist_clear(session.remote_id());
+    session.playlist_cache().invalidate();
 }
 
 int Playlist::position(void) const
 {
     session.ensure_running();
-    return xmms_remote_get_playlist_pos(session.get_id()) + 1;
+    return xmms_remote_get_playlist_pos(session.remote_id()) + 1;
 }
 
 void Playlist::set_position(int pos) const
 {
     check_position(pos);
-    xmms_remote_set_playlist_pos(session.get_id(), pos - 1);
+    session.set_playlist_position(pos - 1);
 }
 
 int Playlist::length(void) const
 {
     session.ensure_running();
-    return xmms_remote_get_playlist_length(session.get_id());
+    return xmms_remote_get_playlist_length(session.remote_id());
 }
 
 string Playlist::title(int pos) const
 {
     check_position(pos);
 
-    char *c_str = xmms_remote_get_playlist_title(session.get_id(), pos - 1);
-    string str(c_str);
+    vector<string> list;
 
-    g_free(c_str);
-    return str;
+    fetch_range(PlaylistCache::TITLES, pos, pos, list);
+    return list.size() ? list[0] : string();
 }
 
 string Playlist::current_title(void) const
@@ -522,11 +812,10 @@ string Playlist::filename(int pos) const
 {
     check_position(pos);
 
-    char *c_str = xmms_remote_get_playlist_file(session.get_id(), pos - 1);
-    string str(c_str);
+    vector<string> list;
 
-    g_free(c_str);
-    return str;
+    fetch_range(PlaylistCache::FILENAMES, pos, pos, list);
+    return list.size() ? list[0] : string();
 }
 
 string Playlist::current_filename(void) const
@@ -537,14 +826,14 @@ string Playlist::current_filename(void) const
 int Playlist::next(void) const
 {
     session.ensure_running();
-    xmms_remote_playlist_next(session.get_id());
+    xmms_remote_playlist_next(session.remote_id());
     return position();
 }
 
 int Playlist::prev(void) const
 {
     session.ensure_running();
-    xmms_remote_playlist_prev(session.get_id());
+    xmms_remote_playlist_prev(session.remote_id());
     return position();
 }
 
@@ -560,6 +849,11 @@ PlaylistPositionOutOfBoundsException::PlaylistPositionOutOfBoundsException(const
 {
 }
 
+PlaylistPositionOutOfBoundsException::PlaylistPositionOutOfBoundsException(int _position, int _length, int min_value)
+    : Exception("PlaylistPositionOutOfBoundsException"), position(_position), length(_length), minv(min_value)
+{
+}
+
 PlaylistPositionOutOfBoundsException::~PlaylistPositionOutOfBoundsException()
 {
 }
@@ -575,34 +869,68 @@ string PlaylistPositionOutOfBoundsException::to_string(void) const
     return buf;
 }
 
-vector<string> Playlist::filenames(void) const
+/*
+ * Positions are 1-based and inclusive; a negative stop means the end of
+ * the playlist.
+ */
+void Playlist::fetch_range(PlaylistCache::Field field, int start, int stop, vector<string>& list) const
 {
-    int len = length();
-    vector<string> list(len);
-    char *c_str;
-
-    for(int i = 0; i < len; i++) {
-        c_str = xmms_remote_get_playlist_file(session.get_id(), i);
-        list[i] = c_str;
-        g_free(c_str);
+    if(start < 1) {
+        start = 1;
     }
+    if(stop < 0) {
+        stop = INT_MAX;
+    }
+    session.playlist_cache().fetch(session, field, start - 1, stop, list);
+}
+
+vector<string> Playlist::filenames(int start, int stop) const
+{
+    vector<string> list;
+
+    fetch_range(PlaylistCache::FILENAMES, start, stop, list);
     return list;
 }
 
-vector<string> Playlist::titles(void) const
+vector<string> Playlist::titles(int start, int stop) const
 {
-    int len = length();
-    vector<string> list(len);
-    char *c_str;
+    vector<string> list;
 
-    for(int i = 0; i < len; i++) {
-        c_str = xmms_remote_get_playlist_title(session.get_id(), i);
-        list[i] = c_str;
-        g_free(c_str);
-    }
+    fetch_range(PlaylistCache::TITLES, start, stop, list);
     return list;
 }
 
+/*
+ * Returns the positions of the entries matching text.  If titles is given,
+ * it receives the title of each of them.
+ */
+vector<int> Playlist::search(const string& text, vector<string> *titles) const
+{
+    vector<int> positions;
+
+    session.playlist_cache().search(session, text, positions, titles);
+    return positions;
+}
+
+/*
+ * Returns the position of the title best matching text as a fuzzy
+ * subsequence, or 0 if none matches.  Ties go to the earlier position.
+ */
+int Playlist::fuzzy_search(const string& text) const
+{
+    vector<pair<int, int> > ranked;
+    int best = 0, best_score = 0;
+
+    session.playlist_cache().fuzzy_search(session, text, ranked);
+    for(vector<pair<int, int> >::const_iterator i = ranked.begin(); i != ranked.end(); i++) {
+        if(!best || i->first > best_score) {
+            best_score = i->first;
+            best = i->second;
+        }
+    }
+    return best;
+}
+
 void Playlist::remove(int pos) const
 {
     remove(pos, pos);
@@ -610,15 +938,340 @@ void Playlist::remove(int pos) const
 
 int Playlist::remove(int pos1, int pos2) const
 {
-    int n = 0;
+    return remove(vector<pair<int, int> >(1, pair<int, int>(pos1, pos2)));
+}
 
-    session.ensure_running();
-    check_position(pos1);
-    check_position(pos2, pos1);
-    while(pos2 >= pos1) {
-        xmms_remote_playlist_delete(session.get_id(), --pos2);
-        n++;
+class DeleteJob : public PipelineJob
+{
+    int pos;
+
+public:
+    DeleteJob(int _pos) : pos(_pos) { }
+
+    virtual void run(gint32 sid, int /*index*/)
+    {
+        xmms_remote_playlist_delete(sid, pos);
+    }
+};
+
+/*
+ * Removes each inclusive range of positions, checked against a single
+ * length query.  Overlapping ranges are merged, and ranges are removed
+ * from the highest down, so earlier removals never shift later ones.
+ * Within a range every request deletes the range's first position.  The
+ * requests are therefore interchangeable and can all be in flight at
+ * once.
+ */
+int Playlist::remove(vector<pair<int, int> > ranges) const
+{
+    int len = length(), n = 0;
+    vector<pair<int, int> > merged;
+
+    for(vector<pair<int, int> >::const_iterator i = ranges.begin(); i != ranges.end(); i++) {
+        if(i->first < 1 || i->first > len) {
+            throw PlaylistPositionOutOfBoundsException(i->first, len);
+        }
+        if(i->second < i->first || i->second > len) {
+            throw PlaylistPositionOutOfBoundsException(i->second, len, i->first);
+        }
+    }
+    sort(ranges.begin(), ranges.end());
+    for(vector<pair<int, int> >::const_iterator i = ranges.begin(); i != ranges.end(); i++) {
+        if(merged.size() && i->first <= merged.back().second + 1) {
+            merged.back().second = max(merged.back().second, i->second);
+        } else {
+            merged.push_back(*i);
+        }
+    }
+    for(vector<pair<int, int> >::reverse_iterator i = merged.rbegin(); i != merged.rend(); i++) {
+        DeleteJob job(i->first - 1);
+
+        session.playlist_cache().removed(i->first - 1, i->second);
+        Pipeline(session).run(job, 0, i->second - i->first + 1);
+        n += i->second - i->first + 1;
     }
     return n;
 }
 
+class ProbeJob : public PipelineJob
+{
+    const vector<int>& indices;
+    const vector<PlaylistCache::Field>& fields;
+    vector<string>& results;
+
+public:
+    ProbeJob(const vector<int>& _indices, const vector<PlaylistCache::Field>& _fields, vector<string>& _results)
+        : indices(_indices), fields(_fields), results(_results) { }
+
+    virtual void run(gint32 sid, int index)
+    {
+        gchar *c_str;
+
+        if(fields[index] == PlaylistCache::FILENAMES) {
+            c_str = xmms_remote_get_playlist_file(sid, indices[index]);
+        } else {
+            c_str = xmms_remote_get_playlist_title(sid, indices[index]);
+        }
+        if(c_str) {
+            results[index] = c_str;
+            g_free(c_str);
+        }
+    }
+};
+
+/*
+ * The cache mirrors the filenames and titles XMMS reports, one flag per
+ * entry saying whether it has been fetched.  It is trusted for
+ * PLAYLIST_CACHE_TTL seconds after each check.  A check costs one length
+ * query plus a few rotating probes, each comparing the first and the last
+ * cached entry of a chunk against XMMS; an insertion or removal inside a
+ * chunk shifts its last entry.  If a probe missed, every cached chunk is
+ * probed and those that no longer match are dropped.  If the length
+ * changed, entries may have shifted anywhere after the change, so
+ * everything from the first chunk that no longer matches onward is
+ * dropped.  Dropped entries are refetched on demand.
+ */
+PlaylistCache::PlaylistCache() : len(-1), grown(false), checked(0), next_probe(0)
+{
+}
+
+const PlaylistCache::Statistics& PlaylistCache::statistics(void) const
+{
+    return stats;
+}
+
+void PlaylistCache::resize(int length)
+{
+    for(int f = 0; f < 2; f++) {
+        entries[f].resize(length);
+        present[f].resize(length, false);
+    }
+    index.resize(length);
+    len = length;
+}
+
+int PlaylistCache::scan(const Session& session, const vector<int>& chunks, bool shifted)
+{
+    vector<int> indices;
+    vector<Field> fields;
+    vector<string> results;
+    int dropped = 0, lowest = len;
+
+    for(vector<int>::const_iterator c = chunks.begin(); c != chunks.end(); c++) {
+        int first = *c * PLAYLIST_CACHE_CHUNK;
+        int last = first + PLAYLIST_CACHE_CHUNK < len ? first + PLAYLIST_CACHE_CHUNK : len;
+
+        for(int f = 0; f < 2; f++) {
+            int i = first, j = last - 1;
+
+            while(i < last && !present[f][i]) {
+                i++;
+            }
+            while(j > i && !present[f][j]) {
+                j--;
+            }
+            if(i == last) {
+                continue;
+            }
+            indices.push_back(i);
+            fields.push_back((Field) f);
+            if(j != i) {
+                indices.push_back(j);
+                fields.push_back((Field) f);
+            }
+        }
+    }
+    results.resize(indices.size());
+
+    ProbeJob probe(indices, fields, results);
+
+    Pipeline(session).run(probe, 0, indices.size());
+    for(unsigned k = 0; k < indices.size(); k++) {
+        if(entries[fields[k]][indices[k]] == results[k]) {
+            continue;
+        }
+
+        int first = indices[k] / PLAYLIST_CACHE_CHUNK * PLAYLIST_CACHE_CHUNK;
+        int last = first + PLAYLIST_CACHE_CHUNK < len ? first + PLAYLIST_CACHE_CHUNK : len;
+
+        dropped++;
+        if(shifted) {
+            lowest = first < lowest ? first : lowest;
+            continue;
+        }
+        /* a different file invalidates the title as well */
+        for(int f = fields[k]; f < 2; f++) {
+            for(int i = first; i < last; i++) {
+                present[f][i] = false;
+            }
+        }
+    }
+    for(int f = 0; f < 2; f++) {
+        for(int i = lowest; i < len; i++) {
+            present[f][i] = false;
+        }
+    }
+    return dropped;
+}
+
+void PlaylistCache::validate(const Session& session)
+{
+    if(len >= 0 && current_time() - checked < PLAYLIST_CACHE_TTL) {
+        return;
+    }
+
+    int newlen = xmms_remote_get_playlist_length(session.remote_id());
+    int nchunks;
+    vector<int> chunks;
+
+    stats.validations++;
+    if(len < 0) {
+        resize(newlen);
+    } else if(newlen != len) {
+        bool appended = grown && newlen > len;
+
+        resize(newlen);
+        nchunks = (len + PLAYLIST_CACHE_CHUNK - 1) / PLAYLIST_CACHE_CHUNK;
+        for(int c = 0; !appended && c < nchunks; c++) {
+            chunks.push_back(c);
+        }
+        scan(session, chunks, true);
+    } else if((nchunks = (len + PLAYLIST_CACHE_CHUNK - 1) / PLAYLIST_CACHE_CHUNK) > 0) {
+        for(int i = 0; i < PLAYLIST_CACHE_PROBES && i < nchunks; i++) {
+            chunks.push_back(next_probe++ % nchunks);
+        }
+        if(scan(session, chunks, false) && (int) chunks.size() < nchunks) {
+            chunks.clear();
+            for(int c = 0; c < nchunks; c++) {
+                chunks.push_back(c);
+            }
+            scan(session, chunks, false);
+        }
+    }
+    grown = false;
+    checked = current_time();
+}
+
+/*
+ * Fetches entries [start, stop) (0-based), going to XMMS only for runs of
+ * entries that are not cached.
+ */
+void PlaylistCache::fetch(const Session& session, Field field, int start, int stop, vector<string>& list)
+{
+    gchar *(*request)(gint, gint) = field == FILENAMES ? xmms_remote_get_playlist_file : xmms_remote_get_playlist_title;
+
+    /*
+     * Checking the cache costs more than fetching a handful of entries, so
+     * small reads of a stale cache go straight to XMMS.
+     */
+    if(stop - start <= PLAYLIST_CACHE_PROBES && (len < 0 || current_time() - checked >= PLAYLIST_CACHE_TTL)) {
+        Pipeline(session).fetch_strings(request, start, stop, list);
+        for(int i = start; i < stop && i < len; i++) {
+            entries[field][i] = list[i - start];
+            present[field][i] = true;
+        }
+        index.touch(start, stop);
+        stats.misses += stop - start;
+        return;
+    }
+    stop = load(session, field, start, stop);
+    list.clear();
+    if(start < stop) {
+        list.assign(entries[field].begin() + start, entries[field].begin() + stop);
+    }
+}
+
+/*
+ * Makes sure entries [start, stop) are cached, going to XMMS only for runs
+ * of entries that are not.  Returns stop bounded by the playlist length.
+ */
+int PlaylistCache::load(const Session& session, Field field, int start, int stop)
+{
+    gchar *(*request)(gint, gint) = field == FILENAMES ? xmms_remote_get_playlist_file : xmms_remote_get_playlist_title;
+    vector<string> fetched;
+
+    validate(session);
+    if(stop > len) {
+        stop = len;
+    }
+    for(int i = start; i < stop; ) {
+        if(present[field][i]) {
+            stats.hits++;
+            i++;
+            continue;
+        }
+
+        int j = i;
+
+        while(j < stop && !present[field][j]) {
+            j++;
+        }
+        Pipeline(session).fetch_strings(request, i, j, fetched);
+        for(int k = i; k < j; k++) {
+            entries[field][k] = fetched[k - i];
+            present[field][k] = true;
+        }
+        index.touch(i, j);
+        stats.misses += j - i;
+        i = j;
+    }
+    return stop;
+}
+
+void PlaylistCache::search(const Session& session, const string& query, vector<int>& positions, vector<string> *titles)
+{
+    load(session, TITLES, 0, INT_MAX);
+    load(session, FILENAMES, 0, INT_MAX);
+    index.update(entries[TITLES], entries[FILENAMES]);
+    index.search(entries[TITLES], entries[FILENAMES], query, positions);
+    if(titles) {
+        titles->clear();
+        titles->reserve(positions.size());
+        for(vector<int>::const_iterator i = positions.begin(); i != positions.end(); i++) {
+            titles->push_back(entries[TITLES][*i - 1]);
+        }
+    }
+}
+
+void PlaylistCache::fuzzy_search(const Session& session, const string& query, vector<pair<int, int> >& ranked)
+{
+    load(session, TITLES, 0, INT_MAX);
+    load(session, FILENAMES, 0, INT_MAX);
+    index.update(entries[TITLES], entries[FILENAMES]);
+    index.fuzzy_search(entries[TITLES], query, ranked);
+}
+
+void PlaylistCache::invalidate(void)
+{
+    for(int f = 0; f < 2; f++) {
+        entries[f].clear();
+        present[f].clear();
+    }
+    index.resize(0);
+    len = -1;
+}
+
+/*
+ * Entries appended at the end leave every cached position intact, so the
+ * next check can skip probing when the playlist has only grown.
+ */
+void PlaylistCache::appended(void)
+{
+    grown = true;
+    checked = 0;
+}
+
+void PlaylistCache::removed(int start, int stop)
+{
+    if(len < 0 || stop > len || start >= stop) {
+        invalidate();
+        return;
+    }
+    for(int f = 0; f < 2; f++) {
+        entries[f].erase(entries[f].begin() + start, entries[f].begin() + stop);
+        present[f].erase(present[f].begin() + start, present[f].begin() + stop);
+    }
+    index.touch(start, len);
+    len -= stop - start;
+    index.resize(len);
+}
@@ -0,0 +1,143 @@
+#include "config.h"
+#include "playlistfile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Playlist files are mapped into memory and scanned in place.  Each entry
+ * is handed to the loader as a pointer and length into the mapping, so
+ * only the current batch is ever copied.  Relative entries are resolved
+ * against the directory of the playlist file, the same way XMMS resolves
+ * them.
+ */
+
+static bool has_suffix(const string& path, const char *suffix)
+{
+    unsigned n = strlen(suffix);
+
+    return path.size() > n && !strcasecmp(path.c_str() + path.size() - n, suffix);
+}
+
+bool playlist_file_is_playlist(const string& path)
+{
+    return has_suffix(path, ".m3u") || has_suffix(path, ".pls");
+}
+
+class EntrySink
+{
+    PlaylistLoader& loader;
+    string dir;
+    string buf;
+
+public:
+    EntrySink(PlaylistLoader& _loader, const string& path) : loader(_loader)
+    {
+        string::size_type p = path.rfind('/');
+
+        if(p != string::npos) {
+            dir = path.substr(0, p + 1);
+        }
+    }
+
+    void add(const char *entry, int length)
+    {
+        while(length && (entry[length - 1] == '\r' || entry[length - 1] == ' ' || entry[length - 1] == '\t')) {
+            length--;
+        }
+        if(!length) {
+            return;
+        }
+        if(entry[0] == '/' || !dir.size() || memmem(entry, length, "://", 3)) {
+            loader.add(entry, length);
+        } else {
+            buf.assign(dir);
+            buf.append(entry, length);
+            loader.add(buf);
+        }
+    }
+};
+
+static void scan_m3u(EntrySink& sink, const char *p, const char *end)
+{
+    while(p < end) {
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+
+        if(!eol) {
+            eol = end;
+        }
+        while(p < eol && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if(p < eol && *p != '#') {
+            sink.add(p, eol - p);
+        }
+        p = eol + 1;
+    }
+}
+
+static void scan_pls(EntrySink& sink, const char *p, const char *end)
+{
+    while(p < end) {
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+        const char *q;
+
+        if(!eol) {
+            eol = end;
+        }
+        if(eol - p > 4 && !strncasecmp(p, "file", 4) && (q = (const char *) memchr(p, '=', eol - p))) {
+            sink.add(q + 1, eol - q - 1);
+        }
+        p = eol + 1;
+    }
+}
+
+/*
+ * Returns the number of entries loaded, or -1 with errno set if the file
+ * could not be read.
+ */
+int playlist_file_load(PlaylistLoader& loader, const string& path)
+{
+    struct stat st;
+    int fd, before = loader.count();
+    void *map;
+    EntrySink sink(loader, path);
+
+    if((fd = open(path.c_str(), O_RDONLY)) < 0) {
+        return -1;
+    }
+    if(fstat(fd, &st) < 0) {
+        int err = errno;
+
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if(st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    try {
+        if(has_suffix(path, ".pls")) {
+            scan_pls(sink, (const char *) map, (const char *) map + st.st_size);
+        } else {
+            scan_m3u(sink, (const char *) map, (const char *) map + st.st_size);
+        }
+    } catch(...) {
+        munmap(map, st.st_size);
+        throw;
+    }
+    munmap(map, st.st_size);
+    loader.flush();
+    return loader.count() - before;
+}
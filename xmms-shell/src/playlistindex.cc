@@ -0,0 +1,242 @@
+#include "config.h"
+#include "playlistindex.h"
+#include <algorithm>
+#include <cctype>
+#include <string.h>
+
+/*
+ * The playlist is indexed in chunks of PLAYLIST_INDEX_CHUNK entries.  For
+ * each chunk, the index keeps the sorted case-folded trigrams found in its
+ * titles and filenames, each with a bitmask of the entries containing it.
+ * A query ANDs together the masks of its trigrams, so only entries that
+ * contain every trigram are checked with a substring match.  Chunks are
+ * marked dirty as the playlist cache learns of changes, and only dirty
+ * chunks are rebuilt.
+ */
+
+#define MASK_WORDS (PLAYLIST_INDEX_CHUNK / 64)
+
+PlaylistIndex::PlaylistIndex() : len(0)
+{
+}
+
+void PlaylistIndex::resize(int length)
+{
+    int n = (length + PLAYLIST_INDEX_CHUNK - 1) / PLAYLIST_INDEX_CHUNK;
+
+    if(len % PLAYLIST_INDEX_CHUNK && len < length) {
+        /* the old last chunk was partial and gains entries */
+        chunks[len / PLAYLIST_INDEX_CHUNK].dirty = true;
+    }
+    chunks.resize(n);
+    if(length < len && n) {
+        chunks[n - 1].dirty = true;
+    }
+    len = length;
+}
+
+/*
+ * Marks entries [first, last) as changed.
+ */
+void PlaylistIndex::touch(int first, int last)
+{
+    if(last > len) {
+        last = len;
+    }
+    for(int c = first / PLAYLIST_INDEX_CHUNK; c * PLAYLIST_INDEX_CHUNK < last; c++) {
+        chunks[c].dirty = true;
+    }
+}
+
+/*
+ * Appends a key for every trigram of str, made of the trigram in the high
+ * bits and the entry's offset within its chunk in the low byte.
+ */
+void PlaylistIndex::add_trigrams(const string& str, unsigned long long entry, vector<unsigned long long>& keys)
+{
+    const unsigned char *p = (const unsigned char *) str.data();
+
+    for(int i = 0; i + 2 < (int) str.size(); i++) {
+        unsigned long long t = tolower(p[i]) << 16 | tolower(p[i + 1]) << 8 | tolower(p[i + 2]);
+
+        keys.push_back(t << 8 | entry);
+    }
+}
+
+void PlaylistIndex::update(const vector<string>& titles, const vector<string>& filenames)
+{
+    vector<unsigned long long> keys;
+
+    for(int c = 0; c < (int) chunks.size(); c++) {
+        Chunk& chunk = chunks[c];
+
+        if(!chunk.dirty) {
+            continue;
+        }
+
+        int first = c * PLAYLIST_INDEX_CHUNK, last = min(len, first + PLAYLIST_INDEX_CHUNK);
+
+        keys.clear();
+        for(int i = first; i < last; i++) {
+            add_trigrams(titles[i], i - first, keys);
+            add_trigrams(filenames[i], i - first, keys);
+        }
+        chunk.signatures.clear();
+        for(int i = first; i < last; i++) {
+            chunk.signatures.push_back(signature(titles[i]));
+        }
+        sort(keys.begin(), keys.end());
+        chunk.trigrams.clear();
+        chunk.masks.clear();
+        for(vector<unsigned long long>::const_iterator k = keys.begin(); k != keys.end(); k++) {
+            unsigned t = *k >> 8, e = *k & 0xff;
+
+            if(chunk.trigrams.empty() || chunk.trigrams.back() != t) {
+                chunk.trigrams.push_back(t);
+                chunk.masks.resize(chunk.masks.size() + MASK_WORDS, 0);
+            }
+            chunk.masks[chunk.masks.size() - MASK_WORDS + e / 64] |= 1ULL << (e % 64);
+        }
+        chunk.dirty = false;
+    }
+}
+
+/*
+ * Appends the 1-based positions of all entries whose title or filename
+ * contains query, ignoring case.
+ */
+void PlaylistIndex::search(const vector<string>& titles, const vector<string>& filenames, const string& query, vector<int>& positions) const
+{
+    vector<unsigned long long> keys;
+    vector<unsigned> wanted;
+
+    add_trigrams(query, 0, keys);
+    for(vector<unsigned long long>::const_iterator k = keys.begin(); k != keys.end(); k++) {
+        wanted.push_back(*k >> 8);
+    }
+    sort(wanted.begin(), wanted.end());
+    wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+    for(int c = 0; c < (int) chunks.size(); c++) {
+        const Chunk& chunk = chunks[c];
+        unsigned long long mask[MASK_WORDS];
+        bool any = true;
+
+        for(int w = 0; w < MASK_WORDS; w++) {
+            mask[w] = ~0ULL;
+        }
+        for(vector<unsigned>::const_iterator t = wanted.begin(); any && t != wanted.end(); t++) {
+            vector<unsigned>::const_iterator p = lower_bound(chunk.trigrams.begin(), chunk.trigrams.end(), *t);
+            const unsigned long long *m = p != chunk.trigrams.end() && *p == *t ? &chunk.masks[(p - chunk.trigrams.begin()) * MASK_WORDS] : 0;
+
+            any = false;
+            for(int w = 0; w < MASK_WORDS; w++) {
+                mask[w] &= m ? m[w] : 0;
+                any = any || mask[w];
+            }
+        }
+        if(!any) {
+            continue;
+        }
+
+        int first = c * PLAYLIST_INDEX_CHUNK, last = min(len, first + PLAYLIST_INDEX_CHUNK);
+
+        for(int i = first; i < last; i++) {
+            if(!(mask[(i - first) / 64] >> ((i - first) % 64) & 1)) {
+                continue;
+            }
+            if(strcasestr(titles[i].c_str(), query.c_str()) || strcasestr(filenames[i].c_str(), query.c_str())) {
+                positions.push_back(i + 1);
+            }
+        }
+    }
+}
+
+/*
+ * A signature has one bit per letter and digit occurring in the string.
+ * A title can only contain the query as a subsequence if its signature
+ * covers the query's, so most titles are rejected with a single AND.
+ */
+unsigned long long PlaylistIndex::signature(const string& str)
+{
+    unsigned long long sig = 0;
+
+    for(string::const_iterator p = str.begin(); p != str.end(); p++) {
+        int c = tolower((unsigned char) *p);
+
+        if(c >= 'a' && c <= 'z') {
+            sig |= 1ULL << (c - 'a');
+        } else if(c >= '0' && c <= '9') {
+            sig |= 1ULL << (c - '0' + 26);
+        }
+    }
+    return sig;
+}
+
+/*
+ * Scores title against query, whose characters must all appear in order
+ * (ignoring case).  Matches that continue the previous one or start a
+ * word score extra, and gaps between matches and long titles cost a
+ * little, so a score may be negative.  Returns false if the query does
+ * not match.
+ */
+bool PlaylistIndex::score(const string& title, const string& query, int& total)
+{
+    int prev = -1, j = 0, n = title.size();
+
+    total = 0;
+    for(string::const_iterator q = query.begin(); q != query.end(); q++) {
+        int c = tolower((unsigned char) *q);
+
+        while(j < n && tolower((unsigned char) title[j]) != c) {
+            j++;
+        }
+        if(j == n) {
+            return false;
+        }
+        total += 16;
+        if(prev >= 0 && j == prev + 1) {
+            total += 8;
+        } else if(prev >= 0) {
+            total -= min(j - prev - 1, 8);
+        }
+        if(j == 0 || !isalnum((unsigned char) title[j - 1])) {
+            total += 8;
+        }
+        prev = j++;
+    }
+    total -= n / 16;
+    return true;
+}
+
+/*
+ * Appends (score, position) for every title matching query as a fuzzy
+ * subsequence.  Spaces in the query are ignored.
+ */
+void PlaylistIndex::fuzzy_search(const vector<string>& titles, const string& query, vector<pair<int, int> >& ranked) const
+{
+    string q;
+    unsigned long long qsig;
+
+    for(string::const_iterator p = query.begin(); p != query.end(); p++) {
+        if(!isspace((unsigned char) *p)) {
+            q += *p;
+        }
+    }
+    qsig = signature(q);
+    for(int c = 0; c < (int) chunks.size(); c++) {
+        const vector<unsigned long long>& sigs = chunks[c].signatures;
+        int first = c * PLAYLIST_INDEX_CHUNK;
+
+        for(int i = 0; i < (int) sigs.size(); i++) {
+            if((sigs[i] & qsig) != qsig) {
+                continue;
+            }
+
+            int s;
+
+            if(score(titles[first + i], q, s)) {
+                ranked.push_back(pair<int, int>(s, first + i + 1));
+            }
+        }
+    }
+}
@@ -1,12 +1,15 @@
 #include "script.h"
 #include "command.h"
+#include "eval.h"
 #include "getline.h"
 #include "playlist.h"
 #include "util.h"
+#include <ctype.h>
 #include <glib.h>
 #include <string.h>
+#include <map>
 
-ScriptContext::ScriptContext()
+ScriptContext::ScriptContext() : continuation(false)
 {
 }
 
@@ -19,6 +22,16 @@ const Session& ScriptContext::session(void) const
     return sess;
 }
 
+bool ScriptContext::is_interactive(void) const
+{
+    return false;
+}
+
+void ScriptContext::set_continuation(bool cont)
+{
+    continuation = cont;
+}
+
 void ScriptContext::set_session(const Session& session)
 {
     sess = session;
@@ -71,82 +84,241 @@ FileContext::~FileContext()
 
 string FileContext::get_line(void)
 {
-    char line[4096];
+    char buf[4096];
+    string line;
 
-    if(!fgets(line, sizeof(line), file)) {
+    while(fgets(buf, sizeof(buf), file)) {
+        line += buf;
+        if(line[line.size() - 1] == '\n') {
+            break;
+        }
+    }
+    if(!line.size()) {
         throw EOFException();
     }
     return line;
 }
 
-InteractiveContext::InteractiveContext()
+/*
+ * Events are delivered while readline waits for a key, so ON hooks run
+ * without the user having to press return first.
+ */
+static const Session *idle_session;
+static bool idle_dispatching, idle_output;
+
+static int idle_pending(void)
+{
+    return idle_session && idle_session->events_pending();
+}
+
+static int idle_dispatch(void)
+{
+    idle_dispatching = true;
+    idle_output = false;
+    idle_session->dispatch();
+    idle_dispatching = false;
+    return idle_output;
+}
+
+InteractiveContext::InteractiveContext() : formatter(sess)
 {
+    getline_set_idle(idle_pending, idle_dispatch);
     set_env("PS1", "%x (%R)> ");
     set_env("RUNNING_PS1", "[%i/%N] %S (%m)> ");
+    set_env("PS2", "> ");
+    set_env("BATCH_PS1", "%x [batch]> ");
 }
 
 InteractiveContext::~InteractiveContext()
 {
 }
 
-InteractiveContext::PromptFormatter::PromptFormatter(Session& session)
+bool InteractiveContext::is_interactive(void) const
 {
-    gint32 rate, freq, nch;
-    gint32 l, r;
+    return true;
+}
 
-    associate('X', "XMMS-Shell");
-    associate('x', "xmms-shell");
-    if(session.is_running()) {
-        associate('R', "running");
-        associate('p', session.is_playing() ? "playing" : "not playing");
-        associate('u', session.is_paused() ? "paused" : "not paused");
-        if(session.is_playing()) {
-            associate('m', session.is_paused() ? "paused" : "playing");
-        } else {
-            associate('m', "stopped");
+/*
+ * The prompt takes one snapshot of just the fields its format uses.
+ */
+static const char *snapshot_specifiers = "pumafntTlrbcsiNFS";
+
+InteractiveContext::PromptFormatter::PromptFormatter(Session& _session) : session(_session), fields(0)
+{
+    prepare(true);
+}
+
+const FormatTable<InteractiveContext::PromptFormatter>& InteractiveContext::PromptFormatter::table(void)
+{
+    static FormatTable<PromptFormatter> t;
+    static bool bound = false;
+
+    if(!bound) {
+        t.bind('X', &PromptFormatter::name);
+        t.bind('x', &PromptFormatter::name);
+        t.bind('R', &PromptFormatter::status);
+        for(const char *p = snapshot_specifiers; *p; p++) {
+            t.bind(*p, &PromptFormatter::value);
         }
-        session.get_playback_info(rate, freq, nch);
-        associate('a', int_to_string(rate));
-        associate('f', int_to_string(freq));
-        associate('n', int_to_string(nch));
-        associate('t', int_to_string(session.get_playback_time()));
-        associate('T', int_to_string(session.get_playback_time() / 1000));
-        session.get_volume(l, r);
-        associate('l', int_to_string(l));
-        associate('r', int_to_string(r));
-        associate('b', int_to_string(session.get_balance()));
-#if HAVE_XMMS_REMOTE_IS_REPEAT
-        associate('c', session.is_repeat() ? "(repeat)" : "");
-#endif
-#if HAVE_XMMS_REMOTE_IS_SHUFFLE
-        associate('s', session.is_shuffle() ? "(shuffle)" : "");
-#endif
-
-        Playlist playlist = session.get_playlist();
-
-        associate('i', int_to_string(playlist.position()));
-        associate('N', int_to_string(playlist.length()));
-        if(playlist.length()) {
-            associate('F', playlist.current_filename());
-            associate('S', playlist.current_title());
+        bound = true;
+    }
+    return t;
+}
+
+unsigned InteractiveContext::PromptFormatter::field(char id)
+{
+    switch(id) {
+        case 'p':
+        case 'u':
+        case 'm':
+            return Session::Snapshot::PLAY_MODE;
+        case 'a':
+        case 'f':
+        case 'n':
+            return Session::Snapshot::INFO;
+        case 't':
+        case 'T':
+            return Session::Snapshot::TIME;
+        case 'l':
+        case 'r':
+            return Session::Snapshot::VOLUME;
+        case 'b':
+            return Session::Snapshot::BALANCE;
+        case 'c':
+            return Session::Snapshot::REPEAT;
+        case 's':
+            return Session::Snapshot::SHUFFLE;
+        case 'i':
+            return Session::Snapshot::POSITION;
+        case 'N':
+            return Session::Snapshot::LENGTH;
+        case 'F':
+            return Session::Snapshot::FILENAME;
+        case 'S':
+            return Session::Snapshot::TITLE;
+    }
+    return 0;
+}
+
+/*
+ * Called before each prompt; whether XMMS is running is then checked at
+ * most once for both choosing and expanding the prompt.
+ */
+void InteractiveContext::PromptFormatter::prepare(bool q)
+{
+    query = q;
+    running_state = -1;
+}
+
+bool InteractiveContext::PromptFormatter::running(void)
+{
+    if(running_state < 0) {
+        running_state = session.snapshot(0).running;
+    }
+    return running_state;
+}
+
+string InteractiveContext::PromptFormatter::expand(const string& format)
+{
+    if(format != compiled.source()) {
+        compiled.compile(format);
+        fields = 0;
+        for(const char *p = snapshot_specifiers; *p; p++) {
+            if(compiled.uses(*p)) {
+                fields |= field(*p);
+            }
         }
-    } else {
-        associate('R', "not running");
     }
+    state = Session::Snapshot();
+    if(query && fields) {
+        state = session.snapshot(fields);
+        running_state = state.running;
+    }
+    return compiled.expand(table(), *this);
+}
+
+string InteractiveContext::PromptFormatter::name(char id)
+{
+    return id == 'X' ? "XMMS-Shell" : "xmms-shell";
+}
+
+string InteractiveContext::PromptFormatter::status(char /*id*/)
+{
+    if(!query) {
+        return "";
+    }
+    return running() ? "running" : "not running";
+}
+
+string InteractiveContext::PromptFormatter::value(char id)
+{
+    if(!(state.fields & field(id))) {
+        return "";
+    }
+    switch(id) {
+        case 'p':
+            return state.playing ? "playing" : "not playing";
+        case 'u':
+            return state.paused ? "paused" : "not paused";
+        case 'm':
+            switch(state.mode()) {
+                case Session::PLAYING:
+                    return "playing";
+                case Session::PAUSED:
+                    return "paused";
+                default:
+                    return "stopped";
+            }
+        case 'a':
+            return int_to_string(state.rate);
+        case 'f':
+            return int_to_string(state.freq);
+        case 'n':
+            return int_to_string(state.nch);
+        case 't':
+            return int_to_string(state.time);
+        case 'T':
+            return int_to_string(state.time / 1000);
+        case 'l':
+            return int_to_string(state.left);
+        case 'r':
+            return int_to_string(state.right);
+        case 'b':
+            return int_to_string(state.balance);
+        case 'c':
+            return state.repeat ? "(repeat)" : "";
+        case 's':
+            return state.shuffle ? "(shuffle)" : "";
+        case 'i':
+            return int_to_string(state.position);
+        case 'N':
+            return int_to_string(state.length);
+        case 'F':
+            return state.filename;
+        case 'S':
+            return state.title;
+    }
+    return "";
 }
 
 string InteractiveContext::get_line(void)
 {
-    PromptFormatter formatter(sess);
-    string promptvar = sess.is_running() ? "RUNNING_PS1" : "PS1";
+    sess.dispatch();
+    // Querying XMMS for the prompt would flush an open batch.
+    formatter.prepare(!sess.batching());
+    string promptvar = continuation ? "PS2" : sess.batching() ? "BATCH_PS1" : formatter.running() ? "RUNNING_PS1" : "PS1";
     string promptval = has_env(promptvar) ? get_env(promptvar) : get_env("PS1");
     string prompt = formatter.expand(promptval);
     char *tmp = g_new(char, prompt.size() + 1);
 
     strcpy(tmp, prompt.c_str());
 
+    idle_session = &sess;
+
     char *buf = getline(tmp);
 
+    idle_session = 0;
+
     g_free(tmp);
     if(!buf) {
         throw EOFException();
@@ -243,9 +415,265 @@ public:
     COM_RETURN("Always 0")
 };
 
+class SourceCommand : public Command
+{
+public:
+    SourceCommand(void) : Command("source") { add_alias("."); }
+    virtual ~SourceCommand() { }
+
+    virtual void execute(CommandContext& cnx) const
+    {
+        int quit;
+
+        if(cnx.args.size() != 2) {
+            cnx.result_code = COMERR_SYNTAX;
+            return;
+        }
+        cnx.result_code = eval_file(cnx.context, cnx.args[1], quit, cnx.context->is_interactive());
+        cnx.quit = quit;
+    }
+
+    COM_SYNOPSIS("run the commands in a script file")
+    COM_SYNTAX("SOURCE <file>")
+    COM_DESCRIPTION(
+        "Reads <file> and executes the commands in it in the current environment, "
+        "as if they had been typed in.  The script is compiled once and kept in "
+        "memory; running it again skips parsing and command lookup unless the file "
+        "has been modified since."
+    )
+    COM_RETURN("The return value of the last command in the script, or 127 if the file could not be read")
+};
+
+class BeginCommand : public Command
+{
+public:
+    BeginCommand(void) : Command("begin") { }
+    virtual ~BeginCommand() { }
+
+    virtual void execute(CommandContext& cnx) const
+    {
+        cnx.session.begin();
+    }
+
+    COM_SYNOPSIS("start a batch of commands")
+    COM_SYNTAX("BEGIN")
+    COM_DESCRIPTION(
+        "Until the matching COMMIT, requests to XMMS whose results are not needed "
+        "(setting the volume, balance or equalizer, seeking, jumping, PLAY and STOP) "
+        "are held back and then sent in the order given; only equalizer settings may "
+        "go out at the same time.  Repeated settings of the same thing are merged "
+        "when only equalizer settings came in between.  Any command that needs an "
+        "answer from XMMS sends what is held back first, so requests still take "
+        "effect in order.  Scripts and commands given with -e are always run as one "
+        "batch."
+    )
+    COM_RETURN("Always 0")
+};
+
+class CommitCommand : public Command
+{
+public:
+    CommitCommand(void) : Command("commit") { }
+    virtual ~CommitCommand() { }
+
+    virtual void execute(CommandContext& cnx) const
+    {
+        if(!cnx.session.commit()) {
+            fprintf(stderr, "COMMIT without BEGIN\n");
+            cnx.result_code = COMERR_NOEFFECT;
+        }
+    }
+
+    COM_SYNOPSIS("send a batch of commands")
+    COM_SYNTAX("COMMIT")
+    COM_DESCRIPTION(
+        "Ends the batch started by the matching BEGIN.  When the outermost batch "
+        "ends, every request held back is sent to XMMS."
+    )
+    COM_RETURN("0 on success, 123 if no batch was open")
+};
+
+enum {
+    HOOK_TRACK_CHANGE = 0x1, HOOK_PLAY = 0x2, HOOK_PAUSE = 0x4, HOOK_STOP = 0x8, HOOK_END_OF_PLAYLIST = 0x10
+};
+
+static const struct {
+    const char *name;
+    unsigned event;
+} hook_events[] = {
+    { "track-change", HOOK_TRACK_CHANGE },
+    { "play", HOOK_PLAY },
+    { "pause", HOOK_PAUSE },
+    { "stop", HOOK_STOP },
+    { "end-of-playlist", HOOK_END_OF_PLAYLIST },
+};
+
+/*
+ * The ON hooks of one session.  Their commands run in a context of their
+ * own, so that they do not disturb whatever script is running when the
+ * event is dispatched.  Entries are never freed: a hook may clear the
+ * hooks while they are being run.
+ */
+class Hooks
+{
+public:
+    StringContext context;
+    vector<pair<unsigned, string> > commands;
+    int subscription;
+
+    Hooks(const Session& session) : context(""), subscription(0) { context.set_session(session); }
+};
+
+static map<gint32, Hooks *> session_hooks;
+
+static Hooks *get_hooks(const Session& session)
+{
+    Hooks *&h = session_hooks[session.get_id()];
+
+    if(!h) {
+        h = new Hooks(session);
+    }
+    return h;
+}
+
+/*
+ * Playback stopping with the last track of the playlist about to end is
+ * taken to be the end of the playlist.  The watcher polls more often as
+ * the end of a track approaches, so its last snapshot is close to it.
+ */
+static unsigned hook_events_between(const Session::Snapshot& before, const Session::Snapshot& after, unsigned events)
+{
+    unsigned hooks = 0;
+
+    if(events & Session::TRACK_CHANGE) {
+        hooks |= HOOK_TRACK_CHANGE;
+    }
+    if(events & Session::PLAY_STATE) {
+        Session::PlayMode from = before.running ? before.mode() : Session::STOPPED;
+        Session::PlayMode to = after.running ? after.mode() : Session::STOPPED;
+
+        if(from != to) {
+            hooks |= to == Session::PLAYING ? HOOK_PLAY : to == Session::PAUSED ? HOOK_PAUSE : HOOK_STOP;
+        }
+        if(from == Session::PLAYING && to == Session::STOPPED && after.running && before.position == before.length
+                && before.duration > 0 && before.duration - before.time <= 2000) {
+            hooks |= HOOK_END_OF_PLAYLIST;
+        }
+    }
+    return hooks;
+}
+
+static void run_hooks(const Session::Snapshot& before, const Session::Snapshot& after, unsigned events, void *data)
+{
+    Hooks *h = (Hooks *) data;
+    unsigned hooks = hook_events_between(before, after, events);
+    vector<pair<unsigned, string> > commands = h->commands;
+    int quit;
+
+    for(vector<pair<unsigned, string> >::const_iterator i = commands.begin(); i != commands.end(); i++) {
+        if(!(i->first & hooks)) {
+            continue;
+        }
+        if(idle_dispatching && !idle_output) {
+            // Leave the prompt line readline is showing.
+            putchar('\n');
+            idle_output = true;
+        }
+        eval_command_string(&h->context, i->second, quit, FALSE);
+    }
+    fflush(stdout);
+}
+
+class OnCommand : public Command
+{
+    static const char *event_name(unsigned event)
+    {
+        for(unsigned i = 0; i < sizeof(hook_events) / sizeof(hook_events[0]); i++) {
+            if(hook_events[i].event == event) {
+                return hook_events[i].name;
+            }
+        }
+        return "";
+    }
+
+public:
+    OnCommand(void) : Command("on") { }
+    virtual ~OnCommand() { }
+
+    virtual void execute(CommandContext& cnx) const
+    {
+        Hooks *h = get_hooks(cnx.session);
+        unsigned event = 0;
+
+        if(cnx.args.size() < 2) {
+            for(vector<pair<unsigned, string> >::const_iterator i = h->commands.begin(); i != h->commands.end(); i++) {
+                printf("ON %s %s\n", event_name(i->first), i->second.c_str());
+            }
+            return;
+        }
+        for(unsigned i = 0; i < sizeof(hook_events) / sizeof(hook_events[0]); i++) {
+            if(!strcasecmp(cnx.args[1].c_str(), hook_events[i].name)) {
+                event = hook_events[i].event;
+            }
+        }
+        if(!event) {
+            fprintf(stderr, "Unknown event: %s\n", cnx.args[1].c_str());
+            cnx.result_code = COMERR_SYNTAX;
+            return;
+        }
+        if(cnx.args.size() == 2) {
+            unsigned n = h->commands.size();
+
+            for(unsigned i = 0; i < h->commands.size(); ) {
+                if(h->commands[i].first == event) {
+                    h->commands.erase(h->commands.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+            if(n == h->commands.size()) {
+                cnx.result_code = COMERR_NOEFFECT;
+            }
+        } else {
+            string command = cnx.raw(2);
+            string::size_type end = command.size();
+
+            while(end && isspace((unsigned char) command[end - 1])) {
+                end--;
+            }
+            h->commands.push_back(make_pair(event, command.substr(0, end)));
+        }
+        if(h->commands.empty() && h->subscription) {
+            cnx.session.unsubscribe(h->subscription);
+            h->subscription = 0;
+        } else if(!h->commands.empty() && !h->subscription) {
+            h->subscription = cnx.session.subscribe(Session::TRACK_CHANGE | Session::PLAY_STATE, run_hooks, h);
+        }
+    }
+
+    COM_SYNOPSIS("run a command when playback changes")
+    COM_SYNTAX("ON [<event> [<command>]]")
+    COM_DESCRIPTION(
+        "Registers <command> to be run whenever <event> happens.  <event> is one of "
+        "TRACK-CHANGE, PLAY, PAUSE, STOP or END-OF-PLAYLIST; END-OF-PLAYLIST happens "
+        "together with STOP when the last track of the playlist plays to its end.  "
+        "Several commands may be registered for the same event and run in the order "
+        "they were given.  Given only an event, ON removes every command registered "
+        "for it; given no arguments, it lists them.  XMMS is watched in the background, "
+        "more often as the end of the current track approaches, and the commands run "
+        "between other commands, while waiting for input at the prompt, or, in a "
+        "daemon started with -d, between forwarded expressions."
+    )
+    COM_RETURN("0 on success, 123 if there was nothing to remove, 125 for an unknown event")
+};
+
 static Command *commands[] = {
     new SetCommand(),
     new UnsetCommand(),
+    new SourceCommand(),
+    new BeginCommand(),
+    new CommitCommand(),
+    new OnCommand(),
 };
 
 void script_init(void)
@@ -1,8 +1,11 @@
 #include "config.h"
 #include "session.h"
+#include "pipeline.h"
 #include "playlist.h"
 #include "util.h"
+#include "watch.h"
 #include "window.h"
+#include <map>
 
 #if HAVE_XMMS_SESSION_CONNECT
 # define SESSION 1
@@ -31,47 +34,388 @@ XmmsQueryFailureException::~XmmsQueryFailureException()
 }
 #endif
 
-Session::Session(int id) : sid(id)
+/*
+ * A control request whose reply nobody reads, held back while a batch is
+ * open.  Equalizer settings (preamp and bands) are independent of each
+ * other, so adjacent ones may be sent in any order.  Everything else must
+ * reach XMMS in the order issued: even volume and balance do not commute,
+ * since setting the balance recomputes both channels from the volume.
+ */
+class Session::Operation
 {
-#if SESSION
-    xs = xmms_session_connect(id);
-    xmms_session_watch(xs);
-    xmms_session_authenticate(xs, NULL);
-    //xmms_session_debug(true);
+public:
+    typedef enum { PREAMP, BAND, VOLUME, BALANCE, TIME, POSITION, PLAY, STOP } Kind;
+
+    Kind kind;
+    gint32 key;
+    gint32 a, b;
+    gfloat f;
+
+    Operation(Kind _kind, gint32 _key = 0, gint32 _a = 0, gint32 _b = 0, gfloat _f = 0)
+        : kind(_kind), key(_key), a(_a), b(_b), f(_f) { }
+
+    bool equalizer(void) const { return kind <= BAND; }
+    bool settles(const Operation& op) const { return kind == op.kind && key == op.key && kind < PLAY; }
+    void send(gint32 sid) const;
+};
+
+void Session::Operation::send(gint32 sid) const
+{
+    switch(kind) {
+        case VOLUME:
+            xmms_remote_set_volume(sid, a, b);
+            break;
+        case BALANCE:
+            xmms_remote_set_balance(sid, a);
+            break;
+#if HAVE_XMMS_REMOTE_SET_EQ_PREAMP
+        case PREAMP:
+            xmms_remote_set_eq_preamp(sid, f);
+            break;
 #endif
+#if HAVE_XMMS_REMOTE_SET_EQ_BAND
+        case BAND:
+            xmms_remote_set_eq_band(sid, key, f);
+            break;
+#endif
+        case TIME:
+            xmms_remote_jump_to_time(sid, a);
+            break;
+        case POSITION:
+            xmms_remote_set_playlist_pos(sid, a);
+            break;
+        case PLAY:
+            xmms_remote_play(sid);
+            break;
+        case STOP:
+            xmms_remote_stop(sid);
+            break;
+        default:
+            break;
+    }
 }
 
-Session::Session(const Session& session) : sid(session.sid)
+/*
+ * Sends a run of adjacent equalizer settings, each on its own connection.
+ */
+class FlushJob : public PipelineJob
+{
+public:
+    vector<Session::Operation *> settings;
+
+    virtual void run(gint32 sid, int index)
+    {
+        settings[index]->send(sid);
+    }
+};
+
+/*
+ * Each index is one independent request whose answer lands in its own
+ * field of the snapshot, so all of them can be in flight at once.
+ */
+class SnapshotJob : public PipelineJob
+{
+public:
+    Session::Snapshot& state;
+    vector<unsigned> requests;
+
+    SnapshotJob(Session::Snapshot& _state) : state(_state) { }
+
+    virtual void run(gint32 sid, int index)
+    {
+        switch(requests[index]) {
+            case Session::Snapshot::PLAY_MODE:
+                state.playing = xmms_remote_is_playing(sid);
+                break;
+            case Session::Snapshot::PLAY_MODE << 16:
+                state.paused = xmms_remote_is_paused(sid);
+                break;
+            case Session::Snapshot::INFO:
+                xmms_remote_get_info(sid, &state.rate, &state.freq, &state.nch);
+                break;
+            case Session::Snapshot::TIME:
+                state.time = xmms_remote_get_output_time(sid);
+                break;
+            case Session::Snapshot::VOLUME:
+                xmms_remote_get_volume(sid, &state.left, &state.right);
+                break;
+            case Session::Snapshot::BALANCE:
+                state.balance = xmms_remote_get_balance(sid);
+                break;
+#if HAVE_XMMS_REMOTE_IS_REPEAT
+            case Session::Snapshot::REPEAT:
+                state.repeat = xmms_remote_is_repeat(sid);
+                break;
+#endif
+#if HAVE_XMMS_REMOTE_IS_SHUFFLE
+            case Session::Snapshot::SHUFFLE:
+                state.shuffle = xmms_remote_is_shuffle(sid);
+                break;
+#endif
+            case Session::Snapshot::SKIN:
+                {
+                    gchar *skin = xmms_remote_get_skin(sid);
+
+                    if(skin) {
+                        state.skin = skin;
+                        g_free(skin);
+                    }
+                }
+                break;
+#if HAVE_XMMS_REMOTE_GET_EQ
+            case Session::Snapshot::EQ:
+                {
+                    float *bands = 0;
+
+                    xmms_remote_get_eq(sid, &state.preamp, &bands);
+                    if(bands) {
+                        state.bands.assign(bands, bands + 10);
+                        g_free(bands);
+                    }
+                }
+                break;
+#endif
+            case Session::Snapshot::POSITION:
+                state.position = xmms_remote_get_playlist_pos(sid) + 1;
+                break;
+            case Session::Snapshot::LENGTH:
+                state.length = xmms_remote_get_playlist_length(sid);
+                break;
+        }
+    }
+};
+
+/*
+ * Every Session copy for a given session identifier shares one Connection.
+ * Under xmmssess this owns the single long-lived socket; under xmmsctrl
+ * XMMS closes the control socket after answering each request, so the
+ * Connection only tracks how many of those connections we open.
+ */
+class Session::Connection
+{
+    static map<gint32, Session::Connection *> pool;
+
+    int refs;
+
+    Connection(gint32 id);
+    ~Connection();
+
+public:
+    gint32 sid;
+    Session::Statistics stats;
+    PlaylistCache *cache;
+    Watcher *watcher;
+    double lease;
+    int batch;
+    vector<Session::Operation> queue;
+
+    bool defer(const Session::Operation& op);
+#if SESSION
+    XMMSSession *xs;
+
+    bool reconnect(void);
+#endif
+
+    static Session::Connection *acquire(gint32 id);
+    static void release(Session::Connection *conn);
+};
+
+map<gint32, Session::Connection *> Session::Connection::pool;
+
+Session::Connection::Connection(gint32 id) : refs(0), sid(id), cache(0), watcher(0), lease(0), batch(0)
 {
 #if SESSION
-    //xs = xmms_session_connect(sid);
-    xs = session.xs;
+    xs = 0;
+    reconnect();
 #endif
 }
 
-Session::~Session()
+Session::Connection::~Connection()
 {
+    for(vector<Session::Operation>::iterator i = queue.begin(); i != queue.end(); i++) {
+        i->send(sid);
+    }
+    delete watcher;
+    delete cache;
 #if SESSION
-    /*
     if(xs) {
         xmms_session_disconnect(xs);
     }
-    */
 #endif
 }
 
+#if SESSION
+bool Session::Connection::reconnect(void)
+{
+    if(xs) {
+        xmms_session_disconnect(xs);
+        stats.reconnects++;
+    }
+    stats.connects++;
+    if(!(xs = xmms_session_connect(sid))) {
+        return false;
+    }
+    xmms_session_watch(xs);
+    xmms_session_authenticate(xs, NULL);
+    //xmms_session_debug(true);
+    return true;
+}
+#endif
+
+/*
+ * Queues op if a batch is open.  A setting replaces an earlier queued
+ * setting of the same thing, provided only equalizer settings lie in between.
+ */
+bool Session::Connection::defer(const Session::Operation& op)
+{
+#if SESSION
+    return false;
+#endif
+    if(!batch) {
+        return false;
+    }
+    for(vector<Session::Operation>::reverse_iterator i = queue.rbegin(); i != queue.rend(); i++) {
+        if(op.settles(*i)) {
+            *i = op;
+            return true;
+        }
+        if(!i->equalizer()) {
+            break;
+        }
+    }
+    queue.push_back(op);
+    return true;
+}
+
+Session::Connection *Session::Connection::acquire(gint32 id)
+{
+    map<gint32, Session::Connection *>::iterator i = pool.find(id);
+    Session::Connection *conn;
+
+    if(i == pool.end()) {
+        conn = new Connection(id);
+        pool[id] = conn;
+    } else {
+        conn = i->second;
+    }
+    conn->refs++;
+    return conn;
+}
+
+void Session::Connection::release(Session::Connection *conn)
+{
+    if(--conn->refs == 0) {
+        pool.erase(conn->sid);
+        delete conn;
+    }
+}
+
+Session::Session(int id) : conn(Connection::acquire(id))
+{
+}
+
+Session::Session(const Session& session) : conn(Connection::acquire(session.conn->sid))
+{
+}
+
+Session& Session::operator=(const Session& session)
+{
+    if(conn != session.conn) {
+        Connection *old = conn;
+
+        conn = Connection::acquire(session.conn->sid);
+        Connection::release(old);
+    }
+    return *this;
+}
+
+Session::~Session()
+{
+    Connection::release(conn);
+}
+
+/*
+ * Opens a batch.  Until the matching commit, control requests whose
+ * results are not read are queued instead of sent; anything that talks
+ * to XMMS for another reason goes through remote_id() and flushes the
+ * queue first, so XMMS still sees requests in program order.  Batches
+ * nest.
+ */
+void Session::begin(void) const
+{
+    conn->batch++;
+}
+
+bool Session::commit(void) const
+{
+    if(!conn->batch) {
+        return false;
+    }
+    if(!--conn->batch) {
+        flush();
+    }
+    return true;
+}
+
+bool Session::batching(void) const
+{
+    return conn->batch > 0;
+}
+
+void Session::flush(void) const
+{
+    vector<Operation> ops;
+    FlushJob job;
+
+    if(conn->queue.empty()) {
+        return;
+    }
+    ops.swap(conn->queue);
+    for(vector<Operation>::iterator i = ops.begin(); i != ops.end(); i++) {
+        if(i->equalizer()) {
+            job.settings.push_back(&*i);
+            continue;
+        }
+        if(job.settings.size()) {
+            Pipeline(*this, PIPELINE_DEPTH, 1).run(job, 0, job.settings.size());
+            job.settings.clear();
+        }
+        i->send(conn->sid);
+    }
+    if(job.settings.size()) {
+        Pipeline(*this, PIPELINE_DEPTH, 1).run(job, 0, job.settings.size());
+    }
+    if(conn->watcher) {
+        conn->watcher->invalidate();
+    }
+}
+
+/*
+ * Ends every open batch, sending what it held back, and forgets the
+ * watcher's snapshot, so that nothing carries over from one client of the
+ * daemon to the next.
+ */
+void Session::reset(void) const
+{
+    conn->batch = 0;
+    flush();
+    if(conn->watcher) {
+        conn->watcher->invalidate();
+    }
+}
+
 #if SESSION
 void Session::update_state(void)
 {
-#define X_ASSERT(X) if((xqr = (X)) != QUERY_SUCCESS) throw XmmsQueryFailureException(xqr, __FILE__, __LINE__)
+#define X_ASSERT(X) if((xqr = (X)) != QUERY_SUCCESS) { expire(); throw XmmsQueryFailureException(xqr, __FILE__, __LINE__); }
     XMMSQueryResult xqr;
     gboolean bv1, bv2;
     gchar *sv;
     gfloat *fv;
 
-    X_ASSERT(xmms_session_get_version(xs, &version));
-    X_ASSERT(xmms_session_get_play_status(xs, &bv1));
-    X_ASSERT(xmms_session_get_pause_status(xs, &bv2));
+    X_ASSERT(xmms_session_get_version(conn->xs, &version));
+    X_ASSERT(xmms_session_get_play_status(conn->xs, &bv1));
+    X_ASSERT(xmms_session_get_pause_status(conn->xs, &bv2));
     if(bv1) {
         if(bv2) {
             mode = PAUSED;
@@ -81,15 +425,15 @@ void Session::update_state(void)
     } else {
         mode = STOPPED;
     }
-    X_ASSERT(xmms_session_get_track_info(xs, &rate, &freq, &nch));
-    X_ASSERT(xmms_session_get_volume(xs, &left_volume, &right_volume));
-    X_ASSERT(xmms_session_get_balance(xs, &balance));
-    X_ASSERT(xmms_session_get_repeat_status(xs, &repeat));
-    X_ASSERT(xmms_session_get_shuffle_status(xs, &shuffle));
-    X_ASSERT(xmms_session_get_skin(xs, &sv));
+    X_ASSERT(xmms_session_get_track_info(conn->xs, &rate, &freq, &nch));
+    X_ASSERT(xmms_session_get_volume(conn->xs, &left_volume, &right_volume));
+    X_ASSERT(xmms_session_get_balance(conn->xs, &balance));
+    X_ASSERT(xmms_session_get_repeat_status(conn->xs, &repeat));
+    X_ASSERT(xmms_session_get_shuffle_status(conn->xs, &shuffle));
+    X_ASSERT(xmms_session_get_skin(conn->xs, &sv));
     skin = sv;
     g_free(sv);
-    X_ASSERT(xmms_session_get_eq(xs, &preamp, &fv));
+    X_ASSERT(xmms_session_get_eq(conn->xs, &preamp, &fv));
     bands = vector<float>(10);
     for(int i = 0; i < 10; i++) {
         bands[i] = fv[i];
@@ -100,14 +444,285 @@ void Session::update_state(void)
 
 void Session::ensure_running(void) const
 {
-    if(!is_running()) {
+    if(!alive()) {
         throw XmmsNotRunningException(*this);
     }
+#if SESSION
+    // Requests on the session handle bypass remote_id().
+    if(conn->watcher) {
+        conn->watcher->invalidate();
+    }
+#endif
+}
+
+/*
+ * Like is_running(), but once XMMS has answered it is assumed to stay up
+ * for SESSION_LEASE seconds, so a command's requests are not each preceded
+ * by a probe of their own.  A request seen to fail calls expire() so the
+ * next check probes again.
+ */
+gboolean Session::alive(void) const
+{
+    if(conn->lease > current_time()) {
+        return TRUE;
+    }
+    return is_running();
+}
+
+void Session::expire(void) const
+{
+    conn->lease = 0;
+}
+
+/*
+ * Barrier: returns once XMMS has handled every request sent before it.
+ * Each control request already waits for its acknowledgement, so a single
+ * round trip is enough; callers use this instead of sleeping between
+ * commands.
+ */
+void Session::sync(void) const
+{
+    is_running();
 }
 
 gint32 Session::get_id(void) const
 {
-    return sid;
+    return conn->sid;
+}
+
+gint32 Session::remote_id(unsigned long requests) const
+{
+    if(conn->queue.size()) {
+        flush();
+    }
+    if(conn->watcher) {
+        conn->watcher->invalidate();
+    }
+    conn->stats.connects += requests;
+    return conn->sid;
+}
+
+const Session::Statistics& Session::statistics(void) const
+{
+    return conn->stats;
+}
+
+void Session::count_command(void) const
+{
+    conn->stats.commands++;
+}
+
+/*
+ * Adds the fields that those asked for depend on and drops the ones this
+ * build cannot fetch.
+ */
+static unsigned snapshot_fields(unsigned fields)
+{
+    if(fields & (Session::Snapshot::TITLE | Session::Snapshot::FILENAME | Session::Snapshot::DURATION)) {
+        fields |= Session::Snapshot::POSITION | Session::Snapshot::LENGTH;
+    }
+#if !SESSION
+#if !HAVE_XMMS_REMOTE_IS_REPEAT
+    fields &= ~Session::Snapshot::REPEAT;
+#endif
+#if !HAVE_XMMS_REMOTE_IS_SHUFFLE
+    fields &= ~Session::Snapshot::SHUFFLE;
+#endif
+#if !HAVE_XMMS_REMOTE_GET_EQ
+    fields &= ~Session::Snapshot::EQ;
+#endif
+#endif
+    return fields;
+}
+
+static void snapshot_requests(unsigned fields, SnapshotJob& job)
+{
+    for(unsigned bit = 1; bit <= Session::Snapshot::LENGTH; bit <<= 1) {
+        if(fields & bit) {
+            job.requests.push_back(bit);
+        }
+    }
+    if(fields & Session::Snapshot::PLAY_MODE) {
+        job.requests.push_back(Session::Snapshot::PLAY_MODE << 16);
+    }
+}
+
+/*
+ * Gathers the requested parts of XMMS's state with all requests in flight
+ * at once, so the cost is about one round trip however many fields are
+ * asked for.  The current title and filename need the position first and
+ * come from the playlist cache afterwards.  Settings held back by an
+ * open batch are sent first, so the snapshot reflects them.
+ */
+const Session::Snapshot Session::snapshot(unsigned fields) const
+{
+    Snapshot state;
+
+    flush();
+    fields = snapshot_fields(fields);
+    if(conn->watcher && conn->watcher->latest(state, fields)) {
+        return state;
+    }
+    state.taken = current_time();
+    if(!(state.running = alive())) {
+        return state;
+    }
+    state.fields = fields;
+#if SESSION
+    Session s(*this);
+
+    if(fields & Snapshot::PLAY_MODE) {
+        state.playing = s.is_playing();
+        state.paused = s.is_paused();
+    }
+    if(fields & Snapshot::INFO) {
+        s.get_playback_info(state.rate, state.freq, state.nch);
+    }
+    if(fields & Snapshot::TIME) {
+        state.time = s.get_playback_time();
+    }
+    if(fields & Snapshot::VOLUME) {
+        s.get_volume(state.left, state.right);
+    }
+    if(fields & Snapshot::BALANCE) {
+        state.balance = s.get_balance();
+    }
+    if(fields & Snapshot::REPEAT) {
+        state.repeat = s.is_repeat();
+    }
+    if(fields & Snapshot::SHUFFLE) {
+        state.shuffle = s.is_shuffle();
+    }
+    if(fields & Snapshot::SKIN) {
+        state.skin = s.get_skin();
+    }
+    if(fields & Snapshot::EQ) {
+        s.get_eq(state.preamp, state.bands);
+    }
+    if(fields & Snapshot::POSITION) {
+        state.position = xmms_remote_get_playlist_pos(remote_id()) + 1;
+    }
+    if(fields & Snapshot::LENGTH) {
+        state.length = xmms_remote_get_playlist_length(remote_id());
+    }
+#else
+    SnapshotJob job(state);
+
+    snapshot_requests(fields, job);
+    Pipeline(*this, PIPELINE_DEPTH, 1).run(job, 0, job.requests.size());
+#endif
+    if(state.length > 0 && state.position > 0) {
+        Playlist playlist = get_playlist();
+
+        if(fields & Snapshot::TITLE) {
+            state.title = playlist.title(state.position);
+        }
+        if(fields & Snapshot::FILENAME) {
+            state.filename = playlist.filename(state.position);
+        }
+        if(fields & Snapshot::DURATION) {
+            state.duration = xmms_remote_get_playlist_time(remote_id(), state.position - 1);
+        }
+    }
+    return state;
+}
+
+/*
+ * Like snapshot(), but touches no state shared with other Session objects
+ * and sends its requests one after another from the calling thread, so it
+ * may be used from a background thread.  Under xmmssess the session handle
+ * belongs to the main thread, so this too uses plain xmmsctrl requests and
+ * leaves out the fields those cannot fetch.
+ */
+const Session::Snapshot Session::poll(gint32 id, unsigned fields)
+{
+    Snapshot state;
+
+    fields = snapshot_fields(fields);
+#if SESSION && !HAVE_XMMS_REMOTE_IS_REPEAT
+    fields &= ~Snapshot::REPEAT;
+#endif
+#if SESSION && !HAVE_XMMS_REMOTE_IS_SHUFFLE
+    fields &= ~Snapshot::SHUFFLE;
+#endif
+#if SESSION && !HAVE_XMMS_REMOTE_GET_EQ
+    fields &= ~Snapshot::EQ;
+#endif
+    state.taken = current_time();
+    if(!(state.running = xmms_remote_is_running(id))) {
+        return state;
+    }
+    state.fields = fields;
+
+    SnapshotJob job(state);
+
+    snapshot_requests(fields, job);
+    for(unsigned i = 0; i < job.requests.size(); i++) {
+        job.run(id, i);
+    }
+    if(state.length > 0 && state.position > 0) {
+        gchar *s;
+
+        if((fields & Snapshot::TITLE) && (s = xmms_remote_get_playlist_title(id, state.position - 1))) {
+            state.title = s;
+            g_free(s);
+        }
+        if((fields & Snapshot::FILENAME) && (s = xmms_remote_get_playlist_file(id, state.position - 1))) {
+            state.filename = s;
+            g_free(s);
+        }
+        if(fields & Snapshot::DURATION) {
+            state.duration = xmms_remote_get_playlist_time(id, state.position - 1);
+        }
+    }
+    return state;
+}
+
+Watcher& Session::watcher(void) const
+{
+    if(!conn->watcher) {
+        conn->watcher = new Watcher(conn->sid);
+    }
+    return *conn->watcher;
+}
+
+/*
+ * Calls listener whenever one of the given events is seen.  Listeners run
+ * on the main thread, from dispatch points such as the command loop, never
+ * from the poller itself; events seen between two dispatches are merged.
+ */
+int Session::subscribe(unsigned events, Session::Listener listener, void *data) const
+{
+    return watcher().subscribe(events, listener, data);
+}
+
+void Session::unsubscribe(int subscription) const
+{
+    watcher().unsubscribe(subscription);
+}
+
+gboolean Session::events_pending(void) const
+{
+    return conn->watcher && conn->watcher->pending_events();
+}
+
+/*
+ * Delivers pending events to their listeners.  Called between commands
+ * and while waiting for input.
+ */
+void Session::dispatch(void) const
+{
+    if(conn->watcher) {
+        conn->watcher->dispatch();
+    }
+}
+
+PlaylistCache& Session::playlist_cache(void) const
+{
+    if(!conn->cache) {
+        conn->cache = new PlaylistCache();
+    }
+    return *conn->cache;
 }
 
 Playlist Session::get_playlist(void) const
@@ -126,36 +741,47 @@ guint32 Session::get_version(void)
     return version;
 #else
     ensure_running();
-    return xmms_remote_get_version(sid);
+    return xmms_remote_get_version(remote_id());
 #endif
 }
 
 gboolean Session::is_running(void) const
 {
+    gboolean running;
+
 #if SESSION
-    return xmms_session_ping(xs, 0) == QUERY_SUCCESS;
+    running = (conn->xs && xmms_session_ping(conn->xs, 0) == QUERY_SUCCESS)
+        || (conn->reconnect() && xmms_session_ping(conn->xs, 0) == QUERY_SUCCESS);
 #else
-    return xmms_remote_is_running(sid);
+    running = xmms_remote_is_running(remote_id());
 #endif
+    conn->lease = running ? current_time() + SESSION_LEASE : 0;
+    return running;
 }
 
 void Session::stop(void)
 {
+    if(conn->defer(Operation(Operation::STOP))) {
+        return;
+    }
     ensure_running();
 #if SESSION
-    xmms_session_stop(xs);
+    xmms_session_stop(conn->xs);
 #else
-    xmms_remote_stop(sid);
+    xmms_remote_stop(remote_id());
 #endif
 }
 
 void Session::play(void)
 {
+    if(conn->defer(Operation(Operation::PLAY))) {
+        return;
+    }
     ensure_running();
 #if SESSION
-    xmms_session_play(xs);
+    xmms_session_play(conn->xs);
 #else
-    xmms_remote_play(sid);
+    xmms_remote_play(remote_id());
 #endif
 }
 
@@ -165,7 +791,7 @@ gboolean Session::is_playing(void)
     return mode != STOPPED;
 #else
     ensure_running();
-    return xmms_remote_is_playing(sid);
+    return xmms_remote_is_playing(remote_id());
 #endif
 }
 
@@ -174,11 +800,11 @@ void Session::pause(gboolean value)
     ensure_running();
 #if SESSION
     if(mode != PAUSED) {
-        xmms_session_pause(xs);
+        xmms_session_pause(conn->xs);
     }
 #else
     if(is_paused() != value) {
-        xmms_remote_pause(sid);
+        xmms_remote_pause(remote_id());
     }
 #endif
 }
@@ -188,11 +814,11 @@ void Session::unpause(void)
     ensure_running();
 #if SESSION
     if(mode == PAUSED) {
-        xmms_session_pause_toggle(xs);
+        xmms_session_pause_toggle(conn->xs);
     }
 #else
     if(is_paused()) {
-        xmms_remote_pause(sid);
+        xmms_remote_pause(remote_id());
     }
 #endif
 }
@@ -201,7 +827,7 @@ Session::PlayMode Session::pause_toggle(void)
 {
     ensure_running();
 #if SESSION
-    xmms_session_pause_toggle(xs);
+    xmms_session_pause_toggle(conn->xs);
     switch(mode) {
         case STOPPED:
             break;
@@ -214,7 +840,7 @@ Session::PlayMode Session::pause_toggle(void)
     }
     return mode;
 #else
-    xmms_remote_pause(sid);
+    xmms_remote_pause(remote_id());
     return get_play_mode();
 #endif
 }
@@ -225,7 +851,7 @@ gboolean Session::is_paused(void)
     return mode == PAUSED;
 #else
     ensure_running();
-    return xmms_remote_is_paused(sid);
+    return xmms_remote_is_paused(remote_id());
 #endif
 }
 
@@ -254,17 +880,20 @@ void Session::get_playback_info(gint32& rate, gint32& freq, gint32 &nch)
     nch = this->nch;
 #else
     ensure_running();
-    xmms_remote_get_info(sid, &rate, &freq, &nch);
+    xmms_remote_get_info(remote_id(), &rate, &freq, &nch);
 #endif
 }
 
 void Session::jump_to_time(gint32 t)
 {
 #if SESSION
-    xmms_session_jump_to_time(xs, t);
+    xmms_session_jump_to_time(conn->xs, t);
 #else
+    if(conn->defer(Operation(Operation::TIME, 0, t))) {
+        return;
+    }
     ensure_running();
-    xmms_remote_jump_to_time(sid, t);
+    xmms_remote_jump_to_time(remote_id(), t);
 #endif
 }
 
@@ -275,12 +904,13 @@ gint32 Session::get_playback_time(void)
     XMMSQueryResult xqr;
     gint32 t;
 
-    if((xqr = xmms_session_get_output_time(xs, &t)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_output_time(conn->xs, &t)) != QUERY_SUCCESS) {
+        expire();
         throw new XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     return t;
 #else
-    return xmms_remote_get_output_time(sid);
+    return xmms_remote_get_output_time(remote_id());
 #endif
 }
 
@@ -289,26 +919,30 @@ void Session::get_volume(gint32& left, gint32& right)
 #if SESSION
     XMMSQueryResult xqr;
     
-    if((xqr = xmms_session_get_volume(xs, &left_volume, &right_volume)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_volume(conn->xs, &left_volume, &right_volume)) != QUERY_SUCCESS) {
+        expire();
         throw new XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     left = left_volume;
     right = right_volume;
 #else
     ensure_running();
-    xmms_remote_get_volume(sid, &left, &right);
+    xmms_remote_get_volume(remote_id(), &left, &right);
 #endif
 }
 
 void Session::set_volume(gint32 left, gint32 right)
 {
+    if(conn->defer(Operation(Operation::VOLUME, 0, left, right))) {
+        return;
+    }
     ensure_running();
 #if SESSION
-    xmms_session_set_volume(xs, left, right);
+    xmms_session_set_volume(conn->xs, left, right);
     left_volume = left;
     right_volume = right;
 #else
-    xmms_remote_set_volume(sid, left, right);
+    xmms_remote_set_volume(remote_id(), left, right);
 #endif
 }
 
@@ -318,18 +952,21 @@ gint32 Session::get_balance(void)
     return balance;
 #else
     ensure_running();
-    return xmms_remote_get_balance(sid);
+    return xmms_remote_get_balance(remote_id());
 #endif
 }
 
 void Session::set_balance(gint32 value)
 {
+    if(conn->defer(Operation(Operation::BALANCE, 0, value))) {
+        return;
+    }
     ensure_running();
 #if SESSION
-    xmms_session_set_balance(xs, value);
+    xmms_session_set_balance(conn->xs, value);
     balance = value;
 #else
-    xmms_remote_set_balance(sid, value);
+    xmms_remote_set_balance(remote_id(), value);
 #endif
 }
 
@@ -341,12 +978,13 @@ gboolean Session::is_repeat(void)
 #if SESSION
     XMMSQueryResult xqr;
 
-    if((xqr = xmms_session_get_repeat_status(xs, &repeat)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_repeat_status(conn->xs, &repeat)) != QUERY_SUCCESS) {
+        expire();
         throw XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     return repeat;
 #else
-    return xmms_remote_is_repeat(sid);
+    return xmms_remote_is_repeat(remote_id());
 #endif
 }
 
@@ -354,7 +992,7 @@ void Session::set_repeat(gboolean value)
 {
 #if SESSION
     ensure_running();
-    xmms_session_set_repeat_status(xs, value);
+    xmms_session_set_repeat_status(conn->xs, value);
     repeat = value;
 #else
     gboolean v = is_repeat();
@@ -372,7 +1010,7 @@ gboolean Session::repeat_toggle(void)
     return repeat;
 #else
     ensure_running();
-    xmms_remote_toggle_repeat(sid);
+    xmms_remote_toggle_repeat(remote_id());
     return is_repeat();
 #endif
 }
@@ -382,7 +1020,7 @@ gboolean Session::repeat_toggle(void)
 void Session::repeat_toggle(void)
 {
     ensure_running();
-    xmms_remote_toggle_repeat(sid);
+    xmms_remote_toggle_repeat(remote_id());
 }
 
 #endif
@@ -395,12 +1033,13 @@ gboolean Session::is_shuffle(void)
 #if SESSION
     XMMSQueryResult xqr;
 
-    if((xqr = xmms_session_get_shuffle_status(xs, &shuffle)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_shuffle_status(conn->xs, &shuffle)) != QUERY_SUCCESS) {
+        expire();
         throw XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     return shuffle;
 #else
-    return xmms_remote_is_shuffle(sid);
+    return xmms_remote_is_shuffle(remote_id());
 #endif
 }
 
@@ -408,7 +1047,7 @@ void Session::set_shuffle(gboolean value)
 {
 #if SESSION
     ensure_running();
-    xmms_session_set_shuffle_status(xs, value);
+    xmms_session_set_shuffle_status(conn->xs, value);
     shuffle = value;
 #else
     gboolean v = is_shuffle();
@@ -426,7 +1065,7 @@ gboolean Session::shuffle_toggle(void)
     return shuffle;
 #else
     ensure_running();
-    xmms_remote_toggle_shuffle(sid);
+    xmms_remote_toggle_shuffle(remote_id());
     return is_shuffle();
 #endif
 }
@@ -436,7 +1075,7 @@ gboolean Session::shuffle_toggle(void)
 void Session::shuffle_toggle(void)
 {
     ensure_running();
-    xmms_remote_toggle_shuffle(sid);
+    xmms_remote_toggle_shuffle(remote_id());
 }
 
 #endif
@@ -447,7 +1086,8 @@ string Session::get_skin(void)
     XMMSQueryResult xqr;
     char *sv;
 
-    if((xqr = xmms_session_get_skin(xs, &sv)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_skin(conn->xs, &sv)) != QUERY_SUCCESS) {
+        expire();
         throw XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     skin = sv;
@@ -455,7 +1095,7 @@ string Session::get_skin(void)
     return skin;
 #else
     ensure_running();
-    return xmms_remote_get_skin(sid);
+    return xmms_remote_get_skin(remote_id());
 #endif
 }
 
@@ -467,7 +1107,8 @@ void Session::get_eq(float& preamp, vector<float>& bands)
     XMMSQueryResult xqr;
     float *fv;
 
-    if((xqr = xmms_session_get_eq(xs, &this->preamp, &fv)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_eq(conn->xs, &this->preamp, &fv)) != QUERY_SUCCESS) {
+        expire();
         throw XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     this->bands = vector<float>(10);
@@ -482,7 +1123,7 @@ void Session::get_eq(float& preamp, vector<float>& bands)
 
     float *c_bands;
 
-    xmms_remote_get_eq(sid, &preamp, &c_bands);
+    xmms_remote_get_eq(remote_id(), &preamp, &c_bands);
     bands = vector<float>(10);
     for(int i = 0; i < 10; i++) {
         bands[i] = c_bands[i];
@@ -496,13 +1137,14 @@ float Session::get_eq_preamp(void)
 #if SESSION
     XMMSQueryResult xqr;
 
-    if((xqr = xmms_session_get_eq_preamp(xs, &preamp)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_eq_preamp(conn->xs, &preamp)) != QUERY_SUCCESS) {
+        expire();
         throw XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     return preamp;
 #else
     ensure_running();
-    return xmms_remote_get_eq_preamp(sid);
+    return xmms_remote_get_eq_preamp(remote_id());
 #endif
 }
 
@@ -512,48 +1154,67 @@ float Session::get_eq_band(gint32 band)
     XMMSQueryResult xqr;
     float v;
 
-    if((xqr = xmms_session_get_eq_band(xs, band, &v)) != QUERY_SUCCESS) {
+    if((xqr = xmms_session_get_eq_band(conn->xs, band, &v)) != QUERY_SUCCESS) {
+        expire();
         throw XmmsQueryFailureException(xqr, __FILE__, __LINE__);
     }
     bands[band] = v;
     return bands[band];
 #else
     ensure_running();
-    return xmms_remote_get_eq_band(sid, band);
+    return xmms_remote_get_eq_band(remote_id(), band);
 #endif
 }
 
 void Session::set_eq_preamp(float value)
 {
+#if !SESSION && HAVE_XMMS_REMOTE_SET_EQ_PREAMP
+    if(conn->defer(Operation(Operation::PREAMP, 0, 0, 0, value))) {
+        return;
+    }
+#endif
     ensure_running();
 #if SESSION
-    xmms_session_set_eq_preamp(xs, value);
+    xmms_session_set_eq_preamp(conn->xs, value);
     preamp = value;
 #else
-    xmms_remote_set_eq_preamp(sid, value);
+    xmms_remote_set_eq_preamp(remote_id(), value);
 #endif
 }
 
 void Session::set_eq_band(gint32 band, float value)
 {
+#if !SESSION && HAVE_XMMS_REMOTE_SET_EQ_BAND
+    if(conn->defer(Operation(Operation::BAND, band, 0, 0, value))) {
+        return;
+    }
+#endif
     ensure_running();
 #if SESSION
-    xmms_session_set_eq_band(xs, band, value);
+    xmms_session_set_eq_band(conn->xs, band, value);
     bands[band] = value;
 #else
-    xmms_remote_set_eq_band(sid, band, value);
+    xmms_remote_set_eq_band(remote_id(), band, value);
 #endif
 }
 
 #endif
 
+void Session::set_playlist_position(gint32 index) const
+{
+    if(conn->defer(Operation(Operation::POSITION, 0, index))) {
+        return;
+    }
+    xmms_remote_set_playlist_pos(remote_id(), index);
+}
+
 void Session::quit(void)
 {
     ensure_running();
 #if SESSION
-    xmms_session_quit(xs);
+    xmms_session_quit(conn->xs);
 #else
-    xmms_remote_quit(sid);
+    xmms_remote_quit(remote_id());
 #endif
 }
 
@@ -1,5 +1,6 @@
 #include "util.h"
 #include <sstream>
+#include <sys/time.h>
 
 string int_to_string(int n)
 {
@@ -11,3 +12,11 @@ string int_to_string(int n)
     return str;
 }
 
+
+double current_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
@@ -0,0 +1,367 @@
+#include "config.h"
+#include "watch.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/*
+ * The fields every poll fetches: enough to detect track and play state
+ * changes and to predict when the current track will end.
+ */
+#define WATCH_BASE_FIELDS (Session::Snapshot::PLAY_MODE | Session::Snapshot::TIME | Session::Snapshot::POSITION | Session::Snapshot::LENGTH | Session::Snapshot::DURATION)
+
+Watcher::Watcher(gint32 id)
+    : sid(id), started(false), stopping(false), demand(0), waiters(0), enabled(false),
+      max_interval(WATCH_MAX_INTERVAL), generation(0), epoch(0), current_epoch(0), dirty(false), pending(0), next_id(1)
+{
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&wakeup, 0);
+    pthread_cond_init(&changed, 0);
+    if(pipe(pipe_fds) < 0) {
+        pipe_fds[0] = pipe_fds[1] = -1;
+    } else {
+        fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(pipe_fds[1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+Watcher::~Watcher()
+{
+    if(started) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_signal(&wakeup);
+        pthread_mutex_unlock(&lock);
+        pthread_join(thread, 0);
+    }
+    if(pipe_fds[0] >= 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+    }
+    pthread_cond_destroy(&changed);
+    pthread_cond_destroy(&wakeup);
+    pthread_mutex_destroy(&lock);
+}
+
+/*
+ * Returns the events that separate two snapshots taken by the poller.
+ * A track change is a new position, or a new file, duration or title at
+ * the same position.  The playback time running backwards is not one: it
+ * is as likely to be a seek as the same track starting over.
+ */
+unsigned Watcher::changes(const Session::Snapshot& before, const Session::Snapshot& after)
+{
+    unsigned events = 0, common = before.fields & after.fields;
+
+    if(!before.taken) {
+        return 0;
+    }
+    if(before.running != after.running || before.mode() != after.mode()) {
+        events |= Session::PLAY_STATE;
+    }
+    if(!before.running || !after.running) {
+        return events;
+    }
+    if(before.position != after.position
+            || ((common & Session::Snapshot::FILENAME) && before.filename != after.filename)
+            || ((common & Session::Snapshot::DURATION) && before.duration != after.duration)
+            || ((common & Session::Snapshot::TITLE) && before.title != after.title)) {
+        events |= Session::TRACK_CHANGE;
+    }
+    if((common & Session::Snapshot::VOLUME) && (before.left != after.left || before.right != after.right)) {
+        events |= Session::VOLUME_CHANGE;
+    }
+    if(before.length != after.length) {
+        events |= Session::PLAYLIST_CHANGE;
+    }
+    return events;
+}
+
+/* Called with the lock held. */
+unsigned Watcher::fields(void) const
+{
+    if(enabled) {
+        return Session::Snapshot::ALL;
+    }
+    if(demand || waiters) {
+        return WATCH_BASE_FIELDS | demand;
+    }
+    return 0;
+}
+
+/*
+ * Polls at max_interval when nothing is playing, and otherwise at half
+ * the time left in the track, so the end of a track is seen within a
+ * small fraction of a second without polling fast all the time.
+ */
+double Watcher::interval(const Session::Snapshot& state) const
+{
+    double remaining;
+
+    if(!state.running || state.mode() != Session::PLAYING || state.duration <= 0) {
+        return max_interval;
+    }
+    remaining = (state.duration - state.time) / 1000.0;
+    if(remaining / 2 < WATCH_MIN_INTERVAL) {
+        return WATCH_MIN_INTERVAL;
+    }
+    return remaining / 2 < max_interval ? remaining / 2 : max_interval;
+}
+
+void *Watcher::worker(void *arg)
+{
+    ((Watcher *) arg)->run();
+    return 0;
+}
+
+void Watcher::run(void)
+{
+    unsigned want;
+    unsigned long started_epoch;
+    struct timespec until;
+    double next;
+
+    pthread_mutex_lock(&lock);
+    while(!stopping) {
+        if(!(want = fields())) {
+            pthread_cond_wait(&wakeup, &lock);
+            continue;
+        }
+        started_epoch = epoch;
+        pthread_mutex_unlock(&lock);
+
+        Session::Snapshot state = Session::poll(sid, want);
+
+        pthread_mutex_lock(&lock);
+
+        unsigned events = changes(current, state);
+
+        if(!current.taken) {
+            delivered = state;
+        }
+        current = state;
+        current_epoch = started_epoch;
+        generation++;
+        if(events) {
+            pending |= events;
+            if(pipe_fds[1] >= 0 && write(pipe_fds[1], "", 1) < 0 && errno != EAGAIN) {
+                close(pipe_fds[1]);
+                pipe_fds[1] = -1;
+            }
+        }
+        pthread_cond_broadcast(&changed);
+        next = state.taken + interval(state);
+        until.tv_sec = (time_t) next;
+        until.tv_nsec = (long) ((next - floor(next)) * 1e9);
+        pthread_cond_timedwait(&wakeup, &lock, &until);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Called with the lock held. */
+void Watcher::start(void)
+{
+    if(!started && !pthread_create(&thread, 0, worker, this)) {
+        started = true;
+    }
+    pthread_cond_signal(&wakeup);
+}
+
+void Watcher::update_demand(void)
+{
+    unsigned events = 0;
+
+    for(vector<Subscription>::const_iterator i = subscriptions.begin(); i != subscriptions.end(); i++) {
+        events |= i->events;
+    }
+    pthread_mutex_lock(&lock);
+    demand = 0;
+    if(events & Session::TRACK_CHANGE) {
+        demand |= Session::Snapshot::TITLE;
+    }
+    if(events & Session::VOLUME_CHANGE) {
+        demand |= Session::Snapshot::VOLUME;
+    }
+    if(events) {
+        demand |= WATCH_BASE_FIELDS;
+        start();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int Watcher::subscribe(unsigned events, Session::Listener listener, void *data)
+{
+    Subscription s;
+
+    s.id = next_id++;
+    s.events = events;
+    s.listener = listener;
+    s.data = data;
+    subscriptions.push_back(s);
+    update_demand();
+    return s.id;
+}
+
+void Watcher::unsubscribe(int id)
+{
+    for(vector<Subscription>::iterator i = subscriptions.begin(); i != subscriptions.end(); i++) {
+        if(i->id == id) {
+            subscriptions.erase(i);
+            break;
+        }
+    }
+    update_demand();
+}
+
+/*
+ * Keeps a full snapshot refreshed in the background, every interval
+ * seconds at most, for latest() to serve.
+ */
+void Watcher::set_polling(bool on, double interval)
+{
+    pthread_mutex_lock(&lock);
+    enabled = on;
+    max_interval = interval > WATCH_MIN_INTERVAL ? interval : WATCH_MIN_INTERVAL;
+    if(on) {
+        start();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+bool Watcher::polling(void) const
+{
+    return enabled;
+}
+
+double Watcher::get_interval(void) const
+{
+    return max_interval;
+}
+
+/*
+ * Copies the poller's latest snapshot into state if it has every field
+ * asked for and is no older than the polling interval allows.
+ */
+bool Watcher::latest(Session::Snapshot& state, unsigned want)
+{
+    bool fresh;
+
+    pthread_mutex_lock(&lock);
+    fresh = current.taken && current_epoch == epoch && (!current.running || (current.fields & want) == want)
+        && current_time() - current.taken <= 2 * max_interval;
+    if(fresh) {
+        state = current;
+    }
+    pthread_mutex_unlock(&lock);
+    return fresh;
+}
+
+/*
+ * Blocks until the poller has taken a snapshot newer than generation or
+ * until deadline (a current_time() value; 0 for none), and returns the
+ * generation of the snapshot copied into state.  Polling is kept running
+ * for as long as somebody waits.
+ */
+unsigned long Watcher::wait(unsigned long gen, double deadline, Session::Snapshot& state)
+{
+    struct timespec until;
+
+    pthread_mutex_lock(&lock);
+    waiters++;
+    start();
+    until.tv_sec = (time_t) deadline;
+    until.tv_nsec = (long) ((deadline - floor(deadline)) * 1e9);
+    while(generation <= gen && !stopping) {
+        if(!deadline) {
+            pthread_cond_wait(&changed, &lock);
+        } else if(pthread_cond_timedwait(&changed, &lock, &until) == ETIMEDOUT) {
+            break;
+        }
+    }
+    waiters--;
+    state = current;
+    gen = generation;
+    pthread_mutex_unlock(&lock);
+    return gen;
+}
+
+/* Asks for a poll now rather than at the end of the current interval. */
+void Watcher::refresh(void)
+{
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Called whenever this process talks to XMMS itself: it may have changed
+ * something, so the latest snapshot can no longer be served.  The poller
+ * is asked to take a new one at the next dispatch point rather than here,
+ * so a command making many requests does not set it polling after each.
+ */
+void Watcher::invalidate(void)
+{
+    pthread_mutex_lock(&lock);
+    epoch++;
+    dirty = true;
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Runs the listeners for whatever has changed since the last dispatch.
+ * Must be called from the main thread.
+ */
+void Watcher::dispatch(void)
+{
+    Session::Snapshot before, after;
+    unsigned events;
+    char buf[64];
+
+    if(pipe_fds[0] >= 0) {
+        while(read(pipe_fds[0], buf, sizeof(buf)) > 0)
+            ;
+    }
+    pthread_mutex_lock(&lock);
+    if(dirty) {
+        dirty = false;
+        pthread_cond_signal(&wakeup);
+    }
+    events = pending;
+    pending = 0;
+    before = delivered;
+    after = delivered = current;
+    pthread_mutex_unlock(&lock);
+    if(!events) {
+        return;
+    }
+
+    vector<Subscription> subs = subscriptions;
+
+    for(vector<Subscription>::const_iterator i = subs.begin(); i != subs.end(); i++) {
+        if(i->events & events) {
+            i->listener(before, after, events & i->events, i->data);
+        }
+    }
+}
+
+unsigned Watcher::pending_events(void)
+{
+    unsigned events;
+
+    pthread_mutex_lock(&lock);
+    events = pending;
+    pthread_mutex_unlock(&lock);
+    return events;
+}
+
+/*
+ * A descriptor that becomes readable when there are events to dispatch,
+ * for callers that wait in select().
+ */
+int Watcher::fd(void) const
+{
+    return pipe_fds[0];
+}
@@ -154,19 +154,19 @@ void Window::ensure_running(void) const
 bool Window::main(void) const
 {
     ensure_running();
-    return xmms_remote_is_main_win(session.get_id());
+    return xmms_remote_is_main_win(session.remote_id());
 }
 
 bool Window::playlist(void) const
 {
     ensure_running();
-    return xmms_remote_is_pl_win(session.get_id());
+    return xmms_remote_is_pl_win(session.remote_id());
 }
 
 bool Window::equalizer(void) const
 {
     ensure_running();
-    return xmms_remote_is_eq_win(session.get_id());
+    return xmms_remote_is_eq_win(session.remote_id());
 }
 
 void Window::show_main(bool value) const
@@ -196,7 +196,7 @@ bool Window::toggle_main(void) const
 
     bool v = !main();
 
-    xmms_remote_main_win_toggle(session.get_id(), v);
+    xmms_remote_main_win_toggle(session.remote_id(), v);
     return v;
 }
 
@@ -206,7 +206,7 @@ bool Window::toggle_playlist(void) const
 
     bool v = !playlist();
 
-    xmms_remote_pl_win_toggle(session.get_id(), v);
+    xmms_remote_pl_win_toggle(session.remote_id(), v);
     return v;
 }
 
@@ -216,19 +216,19 @@ bool Window::toggle_equalizer(void) const
 
     bool v = !equalizer();
 
-    xmms_remote_eq_win_toggle(session.get_id(), v);
+    xmms_remote_eq_win_toggle(session.remote_id(), v);
     return v;
 }
 
 void Window::eject(void) const
 {
     ensure_running();
-    xmms_remote_eject(session.get_id());
+    xmms_remote_eject(session.remote_id());
 }
 
 void Window::preferences(void) const
 {
     ensure_running();
-    xmms_remote_show_prefs_box(session.get_id());
+    xmms_remote_show_prefs_box(session.remote_id());
 }
 
@@ -5,6 +5,7 @@
 #include <xmmsctrl.h>
 #include "config.h"
 #include "command.h"
+#include "daemon.h"
 #include "eval.h"
 #include "general.h"
 #include "getline.h"
@@ -16,7 +17,9 @@
 
 static struct option long_options[] = {
 	{ "session", 1, 0, 'n' },
+	{ "daemon", 0, 0, 'd' },
 	{ "eval", 1, 0, 'e' },
+	{ "file", 1, 0, 'f' },
 	{ "help", 0, 0, 'h' },
 	{ 0, 0, 0, 0 }
 };
@@ -30,18 +33,21 @@ static void display_usage(FILE *f)
 	fprintf(f, "\n");
 	fprintf(f, "Options:\n");
 	fprintf(f, "\n");
+	fprintf(f, "  -d, --daemon             Serve -e requests from a persistent process\n");
 	fprintf(f, "  -e [expr], --eval [expr] Evaluate expr and exit\n");
+	fprintf(f, "  -f [file], --file [file] Run the script in file and exit\n");
 	fprintf(f, "  -h, --help               Display this message and exit\n");
 	fprintf(f, "  -n [s], --session [s]    Specify session ID\n");
 	fprintf(f, "\n");
 	fprintf(f, "If no expression is specified on the command line the program will\n");
-	fprintf(f, "switch into interactive mode.\n");
+	fprintf(f, "switch into interactive mode.  If a daemon is running for the session,\n");
+	fprintf(f, "expressions given with -e are forwarded to it.\n");
 	fprintf(f, "\n");
 }
 
-static int eval_loop(int session_id, FILE *in)
+static int eval_loop(const Session& session, FILE *in)
 {
-	int quit = 0, retval = 127;
+	int quit = 0, retval;
     ScriptContext *context;
 
     if(isatty(fileno(in))) {
@@ -49,17 +55,8 @@ static int eval_loop(int session_id, FILE *in)
     } else {
         context = new FileContext(in);
     }
-    context->set_session(Session(session_id));
-	//while(!quit && (line = getline("xmms-shell> ")))
-    try {
-        while(!quit) {
-            string line = context->get_line();
-
-		    retval = eval_command_string(context, line, quit, TRUE);
-            usleep(100);
-        }
-    } catch(EOFException ex) {
-    }
+    context->set_session(session);
+	retval = eval_script(context, quit, TRUE);
 	if(!quit) {
 		printf("\n");
     }
@@ -69,11 +66,12 @@ static int eval_loop(int session_id, FILE *in)
 int main(int argc, char **argv)
 {
 	int opt, optind;
-	int session_id = 0;
-	char *do_expr = NULL;
+	int session_id = 0, result;
+	bool run_daemon = false;
+	char *do_expr = NULL, *do_file = NULL;
 
 	program_name = argv[0];
-	while((opt = getopt_long(argc, argv, "n:e:h", long_options, &optind)) != -1) {
+	while((opt = getopt_long(argc, argv, "n:de:f:h", long_options, &optind)) != -1) {
 		switch(opt) {
 			case 'h':
 			case 0:
@@ -84,12 +82,24 @@ int main(int argc, char **argv)
 			case 'n':
 				session_id = atoi(optarg);
 				break;
+			case 'd':
+				run_daemon = true;
+				break;
 			case 'e':
 				do_expr = optarg;
 				break;
+			case 'f':
+				do_file = optarg;
+				break;
 		}
 	}
-	if(!xmms_remote_is_running(session_id)) {
+	if(do_expr && !run_daemon && daemon_forward(session_id, do_expr, result)) {
+		return result;
+	}
+
+	Session session(session_id);
+
+	if(!session.is_running()) {
 		fprintf(stderr, "XMMS is not running under the session identifier ``%d''\n", session_id);
 		return 1;
 	}
@@ -105,14 +115,24 @@ int main(int argc, char **argv)
 
 	command_init();
 
+	if(run_daemon) {
+		return daemon_run(session);
+	}
 	if(do_expr) {
         ScriptContext *context = new StringContext(do_expr);
-        context->set_session(Session(session_id));
+        context->set_session(session);
         string line = context->get_line();
         int quit;
 
 		return eval_command_string(context, line, quit, FALSE);
     }
-	return eval_loop(session_id, stdin);
+	if(do_file) {
+        ScriptContext *context = new StringContext("");
+        int quit;
+
+        context->set_session(session);
+        return eval_file(context, do_file, quit, FALSE);
+    }
+	return eval_loop(session, stdin);
 }
 
@@ -6,7 +6,7 @@ TEMPLATE = app
 TARGET =
 DEPENDPATH += . include src
 INCLUDEPATH += . include /usr/include/xmms/
-LIBS += -lxmms
+LIBS += -lxmms -lpthread
 QMAKE_CXXFLAGS += $$system(pkg-config --cflags glib)
 INSTALLS += target
 target.files = xmms-shell
@@ -14,6 +14,8 @@ target.path = /usr/local/bin
 
 # Input
 HEADERS += include/command.h \
+           include/daemon.h \
+           include/dirscan.h \
            include/eval.h \
            include/exception.h \
            include/formatter.h \
@@ -21,14 +23,20 @@ HEADERS += include/command.h \
            include/getline.h \
            include/misc.h \
            include/output.h \
+           include/pipeline.h \
            include/playback.h \
            include/playlist.h \
+           include/playlistfile.h \
+           include/playlistindex.h \
            include/script.h \
            include/session.h \
            include/util.h \
            include/volume.h \
+           include/watch.h \
            include/window.h
 SOURCES += src/command.cc \
+           src/daemon.cc \
+           src/dirscan.cc \
            src/eval.cc \
            src/exception.cc \
            src/formatter.cc \
@@ -36,12 +44,16 @@ SOURCES += src/command.cc \
            src/getline.cc \
            src/misc.cc \
            src/output.cc \
+           src/pipeline.cc \
            src/playback.cc \
            src/playlist.cc \
+           src/playlistfile.cc \
+           src/playlistindex.cc \
            src/script.cc \
            src/session.cc \
            src/util.cc \
            src/volume.cc \
+           src/watch.cc \
            src/window.cc \
            src/xmms-shell.cc
 unix {